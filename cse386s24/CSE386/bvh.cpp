@@ -0,0 +1,369 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "bvh.h"
+
+const double SAH_TRAVERSAL_COST = 1.0;	//!< Cost of visiting a node, relative to testing one primitive.
+
+/**
+ * @fn	static float roundDown(double d)
+ * @brief	Converts to the largest float not greater than d.
+ */
+
+static float roundDown(double d) {
+	float f = (float)d;
+	return f > d ? std::nextafter(f, -FLT_MAX) : f;
+}
+
+/**
+ * @fn	static float roundUp(double d)
+ * @brief	Converts to the smallest float not less than d.
+ */
+
+static float roundUp(double d) {
+	float f = (float)d;
+	return f < d ? std::nextafter(f, FLT_MAX) : f;
+}
+
+/**
+ * @fn	BVH::BVH(const vector<BoundingBox> &boxes, vector<unsigned int> &order, int maxLeafSize)
+ * @brief	Builds a BVH over primitives with the given bounds. Each node is split with
+ * 			the surface area heuristic, evaluated at BVH_BINS planes per axis; a node
+ * 			with maxLeafSize or fewer primitives stays a leaf if splitting would not
+ * 			pay. Large subtrees are built on separate threads.
+ * @param 		  	boxes	   	Bounds of the primitives. Must not be empty boxes.
+ * @param [out]	  	order	   	Set to the primitives in the order the leaves refer to them:
+ * 								leaf (first, count) holds order[first] ... order[first + count - 1].
+ * @param 		  	maxLeafSize	Most primitives a leaf should have.
+ */
+
+BVH::BVH(const vector<BoundingBox>& boxes, vector<unsigned int>& order, int maxLeafSize) {
+	vector<BuildItem> items(boxes.size());
+	for (unsigned int i = 0; i < boxes.size(); i++) {
+		items[i].box = boxes[i];
+		items[i].center = boxes[i].getCenter();
+		items[i].index = i;
+	}
+	order.clear();
+	if (items.empty()) {
+		return;
+	}
+	nodes.reserve(2 * items.size() / std::max(1, maxLeafSize) + 1);
+	int spareThreads = (int)std::thread::hardware_concurrency() - 1;
+	build(items, 0, (unsigned int)items.size(), 0, std::max(1, maxLeafSize), spareThreads, nodes);
+	order.resize(items.size());
+	for (unsigned int i = 0; i < items.size(); i++) {
+		order[i] = items[i].index;
+	}
+}
+
+/**
+ * @fn	BVH::BVH(const BVHNode *nodes, unsigned int nodeCount)
+ * @brief	Makes a BVH from nodes built earlier, such as those stored in a mesh cache.
+ * 			Check them with isValid before traversing.
+ * @param	nodes	 	The nodes.
+ * @param	nodeCount	Number of nodes.
+ */
+
+BVH::BVH(const BVHNode* nodes, unsigned int nodeCount)
+	: nodes(nodes, nodes + nodeCount) {
+}
+
+/**
+ * @fn	BVH BVH::forTriangles(const vector<dvec3> &positions, vector<unsigned int> &indices)
+ * @brief	Builds a BVH over an indexed triangle mesh.
+ * @param 		  	positions	The vertex positions.
+ * @param [in,out]	indices  	Index triplets, one per triangle. They are reordered so that
+ * 								the leaves refer to triangles by their position in it.
+ * @return	The BVH.
+ */
+
+BVH BVH::forTriangles(const vector<dvec3>& positions, vector<unsigned int>& indices) {
+	const unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+	vector<BoundingBox> boxes(numTriangles);
+	for (unsigned int i = 0; i < numTriangles; i++) {
+		boxes[i].expand(positions[indices[3 * i]]);
+		boxes[i].expand(positions[indices[3 * i + 1]]);
+		boxes[i].expand(positions[indices[3 * i + 2]]);
+	}
+	vector<unsigned int> order;
+	BVH bvh(boxes, order);
+	vector<unsigned int> sorted(3 * numTriangles);
+	for (unsigned int i = 0; i < numTriangles; i++) {
+		sorted[3 * i] = indices[3 * order[i]];
+		sorted[3 * i + 1] = indices[3 * order[i] + 1];
+		sorted[3 * i + 2] = indices[3 * order[i] + 2];
+	}
+	indices.swap(sorted);
+	return bvh;
+}
+
+/**
+ * @fn	BoundingBox BVH::getBounds() const
+ * @brief	Gets the bounds of everything in the BVH.
+ * @return	The root's bounds, or an empty box if the BVH is empty.
+ */
+
+BoundingBox BVH::getBounds() const {
+	if (nodes.empty()) {
+		return BoundingBox();
+	}
+	const BVHNode& root = nodes[0];
+	return BoundingBox(dvec3(root.minCorner[0], root.minCorner[1], root.minCorner[2]),
+		dvec3(root.maxCorner[0], root.maxCorner[1], root.maxCorner[2]));
+}
+
+/**
+ * @fn	bool BVH::isValid(unsigned int primitiveCount) const
+ * @brief	Checks that the nodes form a tree traverse can walk: children follow their
+ * 			parent, the tree is no deeper than BVH_MAX_DEPTH, and the leaves refer to
+ * 			primitives that exist.
+ * @param	primitiveCount	Number of primitives.
+ * @return	True if the BVH is safe to traverse.
+ */
+
+bool BVH::isValid(unsigned int primitiveCount) const {
+	const size_t n = nodes.size();
+	vector<int> depth(n, -1);
+	if (n > 0) {
+		depth[0] = 0;
+	}
+	for (size_t i = 0; i < n; i++) {
+		const BVHNode& node = nodes[i];
+		if (depth[i] < 0 || depth[i] >= BVH_MAX_DEPTH) {
+			return false;
+		}
+		if (node.count > 0) {
+			if (node.offset > primitiveCount || node.count > primitiveCount - node.offset) {
+				return false;
+			}
+		} else {
+			if (node.offset <= i + 1 || node.offset >= n) {
+				return false;
+			}
+			depth[i + 1] = depth[node.offset] = depth[i] + 1;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	void BVH::addNode(vector<BVHNode> &nodes, const BoundingBox &box, std::uint32_t offset, std::uint32_t count)
+ * @brief	Appends a node, rounding its bounds outwards to floats.
+ */
+
+void BVH::addNode(vector<BVHNode>& nodes, const BoundingBox& box,
+	std::uint32_t offset, std::uint32_t count) {
+	BVHNode node;
+	for (int i = 0; i < 3; i++) {
+		node.minCorner[i] = roundDown(box.minCorner[i]);
+		node.maxCorner[i] = roundUp(box.maxCorner[i]);
+	}
+	node.offset = offset;
+	node.count = count;
+	nodes.push_back(node);
+}
+
+/**
+ * @fn	static int binOf(double x, double lo, double scale)
+ * @brief	Finds the bin a center coordinate falls in.
+ */
+
+static inline int binOf(double x, double lo, double scale) {
+	return std::min((int)((x - lo) * scale), BVH_BINS - 1);
+}
+
+/**
+ * @fn	unsigned int BVH::binnedSplit(vector<BuildItem> &items, unsigned int first, unsigned int last,
+ * 								const BoundingBox &centers, double &bestCost)
+ * @brief	Finds the best split of a large node by sorting the centers into BVH_BINS
+ * 			bins along each axis and trying each plane between bins, then partitions
+ * 			the items at it.
+ * @param [in,out]	items   	The primitives.
+ * @param 		  	first   	First item of the node.
+ * @param 		  	last	   	One past its last item.
+ * @param 		  	centers 	Bounds of the items' centers.
+ * @param [out]	  	bestCost	Cost of the split.
+ * @return	Start of the second half, or first if no plane separates the centers.
+ */
+
+unsigned int BVH::binnedSplit(vector<BuildItem>& items, unsigned int first, unsigned int last,
+	const BoundingBox& centers, double& bestCost) {
+	const dvec3 lo = centers.minCorner;
+	dvec3 scale;
+	for (int axis = 0; axis < 3; axis++) {
+		double extent = centers.maxCorner[axis] - lo[axis];
+		scale[axis] = extent > 0 ? BVH_BINS / extent : 0.0;
+	}
+	BoundingBox bins[3][BVH_BINS];
+	unsigned int counts[3][BVH_BINS] = {};
+	for (unsigned int i = first; i < last; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			int b = binOf(items[i].center[axis], lo[axis], scale[axis]);
+			counts[axis][b]++;
+			bins[axis][b].expand(items[i].box);
+		}
+	}
+
+	int bestAxis = -1, bestSplit = 0;
+	bestCost = DBL_MAX;
+	for (int axis = 0; axis < 3; axis++) {
+		double rightArea[BVH_BINS];
+		unsigned int rightCount[BVH_BINS];
+		BoundingBox side;
+		unsigned int n = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--) {
+			side.expand(bins[axis][b]);
+			n += counts[axis][b];
+			rightArea[b] = side.getSurfaceArea();
+			rightCount[b] = n;
+		}
+		side = BoundingBox();
+		n = 0;
+		for (int b = 1; b < BVH_BINS; b++) {
+			side.expand(bins[axis][b - 1]);
+			n += counts[axis][b - 1];
+			if (n == 0 || rightCount[b] == 0) {
+				continue;
+			}
+			double cost = side.getSurfaceArea() * n + rightArea[b] * rightCount[b];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+	if (bestAxis < 0) {
+		return first;
+	}
+	return (unsigned int)(std::partition(items.begin() + first, items.begin() + last,
+		[&](const BuildItem& item) {
+			return binOf(item.center[bestAxis], lo[bestAxis], scale[bestAxis]) < bestSplit;
+		}) - items.begin());
+}
+
+/**
+ * @fn	unsigned int BVH::sweepSplit(vector<BuildItem> &items, unsigned int first, unsigned int last, double &bestCost)
+ * @brief	Finds the best split of a small node exactly, by sorting its items along each
+ * 			axis and trying every split of the sorted run, then leaves them sorted along
+ * 			the best axis. Binning is not worth it for so few items.
+ * @param [in,out]	items   	The primitives.
+ * @param 		  	first   	First item of the node; at most BVH_BINS items.
+ * @param 		  	last	   	One past its last item.
+ * @param [out]	  	bestCost	Cost of the split.
+ * @return	Start of the second half.
+ */
+
+unsigned int BVH::sweepSplit(vector<BuildItem>& items, unsigned int first, unsigned int last,
+	double& bestCost) {
+	const unsigned int count = last - first;
+	int bestAxis = 0;
+	unsigned int bestSplit = 1;
+	bestCost = DBL_MAX;
+	for (int axis = 0; axis < 3; axis++) {
+		std::sort(items.begin() + first, items.begin() + last,
+			[axis](const BuildItem& a, const BuildItem& b) { return a.center[axis] < b.center[axis]; });
+		double rightArea[BVH_BINS];
+		BoundingBox side;
+		for (unsigned int i = count - 1; i > 0; i--) {
+			side.expand(items[first + i].box);
+			rightArea[i] = side.getSurfaceArea();
+		}
+		side = BoundingBox();
+		for (unsigned int i = 1; i < count; i++) {
+			side.expand(items[first + i - 1].box);
+			double cost = side.getSurfaceArea() * i + rightArea[i] * (count - i);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+	if (bestAxis != 2) {
+		std::sort(items.begin() + first, items.begin() + last,
+			[bestAxis](const BuildItem& a, const BuildItem& b) { return a.center[bestAxis] < b.center[bestAxis]; });
+	}
+	return first + bestSplit;
+}
+
+/**
+ * @fn	void BVH::build(vector<BuildItem> &items, unsigned int first, unsigned int last,
+ * 						int depth, int maxLeafSize, int spareThreads, vector<BVHNode> &nodes)
+ * @brief	Builds the subtree over items [first, last), appending its nodes depth first.
+ * 			The items are partitioned in place.
+ * @param [in,out]	items	   	The primitives.
+ * @param 		  	first	   	First item of the subtree.
+ * @param 		  	last	   	One past its last item.
+ * @param 		  	depth	   	Depth of the subtree's root.
+ * @param 		  	maxLeafSize	Most primitives a leaf should have.
+ * @param 		  	spareThreads	Threads the subtree may start.
+ * @param [in,out]	nodes	   	Where the nodes go. Inner nodes refer to their second
+ * 								child by its index in this vector.
+ */
+
+void BVH::build(vector<BuildItem>& items, unsigned int first, unsigned int last,
+	int depth, int maxLeafSize, int spareThreads, vector<BVHNode>& nodes) {
+	BoundingBox box, centers;
+	for (unsigned int i = first; i < last; i++) {
+		box.expand(items[i].box);
+		centers.expand(items[i].center);
+	}
+	const unsigned int count = last - first;
+	const size_t nodeIndex = nodes.size();
+	addNode(nodes, box, first, count);
+	if (count == 1 || depth >= BVH_MAX_DEPTH - 1) {
+		return;
+	}
+
+	// A node is split where the sum over its two halves of area * primitives is least.
+	double splitCost;
+	unsigned int mid = count <= (unsigned int)BVH_BINS ?
+		sweepSplit(items, first, last, splitCost) :
+		binnedSplit(items, first, last, centers, splitCost);
+	if (mid == first) {
+		// The centers coincide, so no plane separates them: split the run in half.
+		if (count <= (unsigned int)maxLeafSize) {
+			return;
+		}
+		mid = first + count / 2;
+	} else if (count <= (unsigned int)maxLeafSize &&
+		SAH_TRAVERSAL_COST * box.getSurfaceArea() + splitCost >= box.getSurfaceArea() * count) {
+		return;
+	}
+
+	if (spareThreads > 0 && count >= 2 * MIN_BVH_ITEMS_PER_THREAD) {
+		// Build the second subtree on another thread, then append it, moving its
+		// inner nodes' references to their new place.
+		const int rightThreads = (spareThreads - 1) / 2;
+		vector<BVHNode> rightNodes;
+		std::thread worker([&]() {
+			build(items, mid, last, depth + 1, maxLeafSize, rightThreads, rightNodes);
+		});
+		build(items, first, mid, depth + 1, maxLeafSize, spareThreads - 1 - rightThreads, nodes);
+		worker.join();
+		const std::uint32_t base = (std::uint32_t)nodes.size();
+		for (BVHNode& node : rightNodes) {
+			if (node.count == 0) {
+				node.offset += base;
+			}
+		}
+		nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+		nodes[nodeIndex].offset = base;
+	} else {
+		build(items, first, mid, depth + 1, maxLeafSize, 0, nodes);
+		nodes[nodeIndex].offset = (std::uint32_t)nodes.size();
+		build(items, mid, last, depth + 1, maxLeafSize, 0, nodes);
+	}
+	nodes[nodeIndex].count = 0;
+}
@@ -0,0 +1,164 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include "defs.h"
+#include "ishape.h"
+
+const int BVH_MAX_LEAF_SIZE = 4;	//!< Most primitives the builder puts in a leaf, unless they cannot be split.
+const int BVH_MAX_DEPTH = 64;		//!< Deepest a tree can be; deeper nodes become leaves.
+const int BVH_BINS = 16;			//!< Candidate split planes per axis considered by the builder.
+const unsigned int MIN_BVH_ITEMS_PER_THREAD = 1 << 16;	//!< Smaller subtrees are not worth a thread.
+
+/**
+ * @struct	BVHNode
+ * @brief	A node of a BVH, 32 bytes. The bounds are floats, rounded outwards. Nodes are
+ * 			stored depth first, so an inner node's first child directly follows it.
+ */
+
+struct BVHNode {
+	float minCorner[3];		//!< Minimum corner of the node's bounds.
+	std::uint32_t offset;	//!< Leaf: first primitive. Inner node: index of the second child.
+	float maxCorner[3];		//!< Maximum corner of the node's bounds.
+	std::uint32_t count;	//!< Leaf: number of primitives. Inner node: 0.
+};
+
+/**
+ * @class	BVH
+ * @brief	Bounding volume hierarchy over a set of primitives, built with the surface
+ * 			area heuristic. The tree only knows the primitives' bounding boxes; a leaf
+ * 			refers to a run of primitives, so the caller stores its primitives in the
+ * 			order the builder chose and intersects them in traverse's callback.
+ */
+
+class BVH {
+public:
+	BVH() {}
+	BVH(const vector<BoundingBox>& boxes, vector<unsigned int>& order,
+		int maxLeafSize = BVH_MAX_LEAF_SIZE);
+	BVH(const BVHNode* nodes, unsigned int nodeCount);
+	static BVH forTriangles(const vector<dvec3>& positions, vector<unsigned int>& indices);
+	bool isEmpty() const { return nodes.empty(); }
+	unsigned int getNodeCount() const { return (unsigned int)nodes.size(); }
+	const BVHNode* getNodes() const { return nodes.data(); }
+	BoundingBox getBounds() const;
+	bool isValid(unsigned int primitiveCount) const;
+	template <class LeafFunction>
+	void traverse(const Ray& ray, double& tMax, LeafFunction intersectLeaf) const;
+protected:
+	struct BuildItem {
+		BoundingBox box;		//!< Bounds of the primitive.
+		dvec3 center;			//!< Center of box.
+		unsigned int index;		//!< The primitive.
+	};
+	static void build(vector<BuildItem>& items, unsigned int first, unsigned int last,
+		int depth, int maxLeafSize, int spareThreads, vector<BVHNode>& nodes);
+	static unsigned int binnedSplit(vector<BuildItem>& items, unsigned int first, unsigned int last,
+		const BoundingBox& centers, double& bestCost);
+	static unsigned int sweepSplit(vector<BuildItem>& items, unsigned int first, unsigned int last,
+		double& bestCost);
+	static void addNode(vector<BVHNode>& nodes, const BoundingBox& box,
+		std::uint32_t offset, std::uint32_t count);
+	static bool hitBox(const BVHNode& node, const dvec3& origin, const dvec3& invDir,
+		double tMax, double& tEntry);
+	vector<BVHNode> nodes;	//!< The tree; nodes[0] is the root.
+};
+
+/**
+ * @fn	inline bool BVH::hitBox(const BVHNode &node, const dvec3 &origin, const dvec3 &invDir,
+ * 							double tMax, double &tEntry)
+ * @brief	Slab test of a ray against a node's bounds.
+ * @param 	node  	The node.
+ * @param 	origin	The ray's origin.
+ * @param 	invDir	1 / the ray's direction, per component.
+ * @param 	tMax  	Farthest distance of interest.
+ * @param	tEntry	Set to where the ray enters the bounds.
+ * @return	True if the ray enters the bounds between 0 and tMax.
+ */
+
+inline bool BVH::hitBox(const BVHNode& node, const dvec3& origin, const dvec3& invDir,
+	double tMax, double& tEntry) {
+	double tNear = 0.0, tFar = tMax;
+	for (int i = 0; i < 3; i++) {
+		double t1 = (node.minCorner[i] - origin[i]) * invDir[i];
+		double t2 = (node.maxCorner[i] - origin[i]) * invDir[i];
+		if (t1 > t2) {
+			std::swap(t1, t2);
+		}
+		// Written so that a NaN, from a ray lying in a slab's plane, leaves the range alone.
+		tNear = t1 > tNear ? t1 : tNear;
+		tFar = t2 < tFar ? t2 : tFar;
+	}
+	tEntry = tNear;
+	return tNear <= tFar;
+}
+
+/**
+ * @fn	template <class LeafFunction> void BVH::traverse(const Ray &ray, double &tMax, LeafFunction intersectLeaf) const
+ * @brief	Visits the leaves a ray passes through, nearest first, skipping any entered
+ * 			beyond tMax.
+ * @param 		  	ray			 	The ray.
+ * @param [in,out]	tMax		 	Farthest distance of interest. The callback lowers it
+ * 									when it finds a hit, which prunes the rest of the walk.
+ * @param 		  	intersectLeaf	Called as intersectLeaf(first, count, tMax) for the
+ * 									primitives [first, first + count) of each leaf.
+ */
+
+template <class LeafFunction>
+void BVH::traverse(const Ray& ray, double& tMax, LeafFunction intersectLeaf) const {
+	struct Pending {
+		unsigned int index;		//!< A node still to visit.
+		double tEntry;			//!< Where the ray enters it.
+	};
+	double tEntry;
+	if (nodes.empty()) {
+		return;
+	}
+	const dvec3 invDir(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	if (!hitBox(nodes[0], ray.origin, invDir, tMax, tEntry)) {
+		return;
+	}
+	Pending stack[BVH_MAX_DEPTH];
+	int size = 0;
+	unsigned int index = 0;
+	while (true) {
+		const BVHNode& node = nodes[index];
+		if (node.count > 0) {
+			intersectLeaf(node.offset, node.count, tMax);
+		} else {
+			unsigned int nearChild = index + 1, farChild = node.offset;
+			double tNear, tFar;
+			bool hitNear = hitBox(nodes[nearChild], ray.origin, invDir, tMax, tNear);
+			bool hitFar = hitBox(nodes[farChild], ray.origin, invDir, tMax, tFar);
+			if (hitNear && hitFar) {
+				if (tFar < tNear) {
+					std::swap(nearChild, farChild);
+					std::swap(tNear, tFar);
+				}
+				stack[size].index = farChild;
+				stack[size].tEntry = tFar;
+				size++;
+				index = nearChild;
+				continue;
+			} else if (hitNear || hitFar) {
+				index = hitNear ? nearChild : farChild;
+				continue;
+			}
+		}
+		do {
+			if (size == 0) {
+				return;
+			}
+			size--;
+		} while (stack[size].tEntry > tMax);
+		index = stack[size].index;
+	}
+}
@@ -171,6 +171,7 @@ vector<Ray> OrthographicCamera::getRay(double x, double y, int N) const {
 	vector<dvec2> uv = getProjectionPlaneCoordinates(x, y, N);
 	for (int i = 0; i < uv.size(); i++) {
 		rays.push_back(Ray(cameraFrame.origin + uv[i].x * cameraFrame.u + uv[i].y * cameraFrame.v, -cameraFrame.w));
+		rays.back().coneWidth = (top - bottom) / (ny * N);	// Each ray covers 1/N of a pixel.
 	}
 	return rays;
 }
@@ -199,6 +200,7 @@ vector<Ray> PerspectiveCamera::getRay(double x, double y, int N) const {
 			uv[i].x * cameraFrame.u +
 			uv[i].y * cameraFrame.v);
 		rays.push_back(Ray(cameraFrame.origin, rayDirection));
+		rays.back().coneSpread = (top - bottom) / (ny * N * distToPlane);	// 1/N of a pixel's angle.
 	}
 	return rays;
 }
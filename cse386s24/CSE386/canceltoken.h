@@ -0,0 +1,42 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <atomic>
+
+const int CANCEL_CHECK_INTERVAL = 256;	//!< Triangles rasterized between checks for cancellation.
+
+/**
+ * @class	CancelToken
+ * @brief	Lets one thread ask work running on other threads to stop early. The work
+ * 			checks isCancelled at convenient points (per tile, per draw) and returns
+ * 			if it is set, leaving its output partially written.
+ */
+
+class CancelToken {
+public:
+	CancelToken() : cancelled(false) {}
+	void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+	void reset() { cancelled.store(false, std::memory_order_relaxed); }
+	bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+protected:
+	std::atomic<bool> cancelled;	//!< True once cancel has been called.
+};
+
+/**
+ * @fn	inline bool isCancelled(const CancelToken *cancelToken)
+ * @brief	Checks an optional cancel token.
+ * @param	cancelToken	The token, or nullptr if the work cannot be cancelled.
+ * @return	True if the token exists and has been cancelled.
+ */
+
+inline bool isCancelled(const CancelToken* cancelToken) {
+	return cancelToken != nullptr && cancelToken->isCancelled();
+}
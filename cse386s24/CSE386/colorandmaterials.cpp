@@ -100,6 +100,68 @@ Material Material::operator +(const Material& mat) const {
 	return result;
 }
 
+/**
+ * @fn	bool Material::operator==(const Material &mat) const
+ * @brief	Determines if two Materials are identical.
+ * @param	mat	The second Material.
+ * @return	true iff all the material properties match exactly.
+ */
+
+bool Material::operator ==(const Material& mat) const {
+	return ambient == mat.ambient && diffuse == mat.diffuse &&
+		specular == mat.specular && shininess == mat.shininess;
+}
+
+/**
+ * @fn	size_t MaterialHash::operator()(const Material &mat) const
+ * @brief	Hashes every property of a material. std::hash<double> gives 0.0 and -0.0,
+ * 			which compare equal, the same hash.
+ * @param	mat	The material.
+ * @return	The hash.
+ */
+
+size_t MaterialHash::operator ()(const Material& mat) const {
+	const double values[] = { mat.ambient.r, mat.ambient.g, mat.ambient.b,
+							mat.diffuse.r, mat.diffuse.g, mat.diffuse.b,
+							mat.specular.r, mat.specular.g, mat.specular.b,
+							mat.shininess };
+	std::hash<double> hashValue;
+	size_t hash = 0;
+	for (double value : values) {
+		hash ^= hashValue(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	}
+	return hash;
+}
+
+/**
+ * @fn	unsigned short MaterialTable::indexOf(const Material &mat)
+ * @brief	Finds the index of a material, adding it to the table if it is not already
+ * 			present. Consecutive lookups are usually for the same material, so the
+ * 			previous result is checked before the hash table.
+ * @param	mat	The material to look up.
+ * @return	The index of the material, or OVERFLOW_MATERIAL if it is new and the table
+ * 			already holds OVERFLOW_MATERIAL materials. The caller must then keep the
+ * 			material itself.
+ */
+
+unsigned short MaterialTable::indexOf(const Material& mat) {
+	if (lastIndex != NO_MATERIAL && materials[lastIndex] == mat) {
+		return lastIndex;
+	}
+	auto found = indices.find(mat);
+	if (found != indices.end()) {
+		lastIndex = found->second;
+		return lastIndex;
+	}
+	if (materials.size() >= OVERFLOW_MATERIAL) {
+		return OVERFLOW_MATERIAL;
+	}
+	lastIndex = (unsigned short)materials.size();
+	materials.push_back(mat);
+	indices[mat] = lastIndex;
+	return lastIndex;
+}
+
 /**
  * @fn	Material operator*(double w, const Material &mat)
  * @brief	Multiply a Material and a scalar.
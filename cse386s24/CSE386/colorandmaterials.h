@@ -8,6 +8,7 @@
  ****************************************************/
 
 #pragma once
+#include <unordered_map>
 #include <vector>
 #include "defs.h"
 
@@ -46,6 +47,38 @@ struct Material {
 	Material operator *(double w) const;
 	Material& operator +=(const Material& mat);
 	Material operator +(const Material& mat) const;
+	bool operator ==(const Material& mat) const;
+	bool operator !=(const Material& mat) const { return !(*this == mat); }
+};
+
+const unsigned short NO_MATERIAL = 0xFFFF;		//!< Material index meaning "no material".
+const unsigned short OVERFLOW_MATERIAL = 0xFFFE;	//!< Material index meaning "the table was full".
+
+/**
+ * @struct	MaterialHash
+ * @brief	Hash of a Material, consistent with Material::operator==.
+ */
+
+struct MaterialHash {
+	size_t operator ()(const Material& mat) const;
+};
+
+/**
+ * @struct	MaterialTable
+ * @brief	A table of distinct materials. Lets per-pixel or per-vertex data refer
+ * 			to a material with a small index rather than carrying a full copy.
+ */
+
+struct MaterialTable {
+	vector<Material> materials;		//!< The distinct materials, in order of insertion.
+	MaterialTable() : lastIndex(NO_MATERIAL) {}
+	unsigned short indexOf(const Material& mat);
+	const Material& operator [](unsigned short i) const { return materials[i]; }
+	size_t size() const { return materials.size(); }
+	void clear() { materials.clear(); indices.clear(); lastIndex = NO_MATERIAL; }
+protected:
+	std::unordered_map<Material, unsigned short, MaterialHash> indices;	//!< Index of each material.
+	unsigned short lastIndex;		//!< Index returned by the previous lookup.
 };
 
 // http://www.it.hiof.no/~borres/j3d/explain/light/p-materials.html
@@ -0,0 +1,183 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <thread>
+#include "drawlist.h"
+
+int DrawList::minDrawsPerThread = 4;
+
+/**
+ * @fn	void DrawList::add(const EShapeData &triangles, const dmat4 &modelingMatrix,
+ *							bool renderBackfaces)
+ * @brief	Records a draw of unindexed triangles.
+ * @param	triangles	   	The triangles.
+ * @param	modelingMatrix 	The transformation applied to the object.
+ * @param	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void DrawList::add(const EShapeData& triangles, const dmat4& modelingMatrix,
+	bool renderBackfaces) {
+	DrawCommand command = { &triangles, nullptr, nullptr, modelingMatrix, renderBackfaces };
+	commands.push_back(command);
+}
+
+/**
+ * @fn	void DrawList::add(const IndexedEShapeData &mesh, const dmat4 &modelingMatrix,
+ *							bool renderBackfaces)
+ * @brief	Records a draw of an indexed mesh.
+ * @param	mesh		   	The mesh.
+ * @param	modelingMatrix 	The transformation applied to the object.
+ * @param	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void DrawList::add(const IndexedEShapeData& mesh, const dmat4& modelingMatrix,
+	bool renderBackfaces) {
+	DrawCommand command = { nullptr, &mesh, nullptr, modelingMatrix, renderBackfaces };
+	commands.push_back(command);
+}
+
+/**
+ * @fn	void DrawList::add(const CompactEShapeData &mesh, const dmat4 &modelingMatrix,
+ *							bool renderBackfaces)
+ * @brief	Records a draw of a mesh in the compact vertex format.
+ * @param	mesh		   	The mesh.
+ * @param	modelingMatrix 	The transformation applied to the object.
+ * @param	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void DrawList::add(const CompactEShapeData& mesh, const dmat4& modelingMatrix,
+	bool renderBackfaces) {
+	DrawCommand command = { nullptr, nullptr, &mesh, modelingMatrix, renderBackfaces };
+	commands.push_back(command);
+}
+
+/**
+ * @fn	void DrawList::transformRange(size_t first, size_t last, const FrameConstants &constants,
+ *										VertexArena &arena, const CancelToken *cancelToken) const
+ * @brief	Runs the vertex stage for commands[first, last), appending the finished
+ * 			triangles to arena.windowCoords.
+ * @param 		  	first	   	First command.
+ * @param 		  	last	   	One past the last command.
+ * @param 		  	constants  	Per frame values.
+ * @param [in,out]	arena	   	Scratch storage and output.
+ * @param 		  	cancelToken	If not nullptr, checked before each command.
+ */
+
+void DrawList::transformRange(size_t first, size_t last, const FrameConstants& constants,
+	VertexArena& arena, const CancelToken* cancelToken) const {
+	for (size_t i = first; i < last; i++) {
+		if (isCancelled(cancelToken)) {
+			return;
+		}
+		const DrawCommand& cmd = commands[i];
+		if (cmd.triangles != nullptr) {
+			VertexOps::transformTriangles(*cmd.triangles, cmd.modelingMatrix, constants,
+				cmd.renderBackfaces, arena);
+		} else if (cmd.indexedMesh != nullptr) {
+			VertexOps::transformTriangles(*cmd.indexedMesh, cmd.modelingMatrix, constants,
+				cmd.renderBackfaces, arena);
+		} else if (cmd.compactMesh != nullptr) {
+			VertexOps::transformTriangles(*cmd.compactMesh, cmd.modelingMatrix, constants,
+				cmd.renderBackfaces, arena);
+		}
+	}
+}
+
+/**
+ * @fn	void DrawList::submit(FrameBuffer &frameBuffer, const vector<LightSourcePtr> &lights,
+ *								const PipelineMatrices &pipeMats)
+ * @brief	Renders all the recorded draws. The commands are split into contiguous ranges,
+ * 			one per thread, and each thread runs the vertex stage of its range into its
+ * 			own arena. If the framebuffer accepts concurrent writes, each thread then
+ * 			rasterizes its own arena; otherwise the arenas are rasterized in order.
+ * 			Either way the image is the same as rendering the draws one at a time.
+ * 			The list is not cleared.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	pipeMats   	The pipeline matrices.
+ * @param 		  	cancelToken	If not nullptr, checked before each draw and periodically
+ * 								while rasterizing.
+ * @return	False if the submission was cancelled before it finished.
+ */
+
+bool DrawList::submit(FrameBuffer& frameBuffer, const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats, const CancelToken* cancelToken) {
+	if (commands.empty()) {
+		return !isCancelled(cancelToken);
+	}
+	const FrameConstants constants(pipeMats);
+	const size_t N = commands.size();
+
+	const size_t drawsPerThread = std::max(minDrawsPerThread, 1);
+	size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = std::min(numThreads, (N + drawsPerThread - 1) / drawsPerThread);
+	if (arenas.size() < numThreads) {
+		arenas.resize(numThreads);
+	}
+	const size_t perThread = (N + numThreads - 1) / numThreads;
+
+	for (size_t t = 0; t < numThreads; t++) {
+		arenas[t].windowCoords.clear();
+	}
+	const bool concurrent = FragmentOps::canWriteConcurrently(frameBuffer);
+	vector<std::thread> workers;
+	for (size_t t = 1; t < numThreads; t++) {
+		size_t first = std::min(N, t * perThread);
+		size_t last = std::min(N, first + perThread);
+		if (concurrent) {
+			workers.push_back(std::thread(&DrawList::transformAndDrawRange, this,
+				first, last, std::cref(constants), std::ref(arenas[t]),
+				std::ref(frameBuffer), std::cref(lights), cancelToken));
+		} else {
+			workers.push_back(std::thread(&DrawList::transformRange, this,
+				first, last, std::cref(constants), std::ref(arenas[t]), cancelToken));
+		}
+	}
+	transformRange(0, std::min(N, perThread), constants, arenas[0], cancelToken);
+	if (concurrent) {
+		drawManyFilledTriangles(frameBuffer, constants.eyePos, lights,
+			arenas[0].windowCoords, constants.eyeFrame, cancelToken);
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	if (!concurrent) {
+		for (size_t t = 0; t < numThreads; t++) {
+			drawManyFilledTriangles(frameBuffer, constants.eyePos, lights,
+				arenas[t].windowCoords, constants.eyeFrame, cancelToken);
+		}
+	}
+	return !isCancelled(cancelToken);
+}
+
+/**
+ * @fn	void DrawList::transformAndDrawRange(size_t first, size_t last,
+ *								const FrameConstants &constants, VertexArena &arena,
+ *								FrameBuffer &frameBuffer, const vector<LightSourcePtr> &lights,
+ *								const CancelToken *cancelToken) const
+ * @brief	Runs the vertex stage for commands[first, last) and rasterizes the result.
+ * 			Only used when the framebuffer accepts concurrent writes.
+ * @param 		  	first	   	First command.
+ * @param 		  	last	   	One past the last command.
+ * @param 		  	constants  	Per frame values.
+ * @param [in,out]	arena	   	Scratch storage and output.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	cancelToken	If not nullptr, checked before each command and
+ * 								periodically while rasterizing.
+ */
+
+void DrawList::transformAndDrawRange(size_t first, size_t last, const FrameConstants& constants,
+	VertexArena& arena, FrameBuffer& frameBuffer, const vector<LightSourcePtr>& lights,
+	const CancelToken* cancelToken) const {
+	transformRange(first, last, constants, arena, cancelToken);
+	drawManyFilledTriangles(frameBuffer, constants.eyePos, lights, arena.windowCoords,
+		constants.eyeFrame, cancelToken);
+}
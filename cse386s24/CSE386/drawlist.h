@@ -0,0 +1,58 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "defs.h"
+#include "eshape.h"
+#include "vertexops.h"
+#include "canceltoken.h"
+
+/**
+ * @struct	DrawCommand
+ * @brief	One recorded draw: a mesh, its modeling matrix and flags. Exactly one of
+ * 			the mesh pointers is set.
+ */
+
+struct DrawCommand {
+	const EShapeData* triangles;			//!< Unindexed triangles, or nullptr.
+	const IndexedEShapeData* indexedMesh;	//!< Indexed mesh, or nullptr.
+	const CompactEShapeData* compactMesh;	//!< Compact mesh, or nullptr.
+	dmat4 modelingMatrix;					//!< The transformation applied to the mesh.
+	bool renderBackfaces;					//!< True if backfaces are to be rendered.
+};
+
+/**
+ * @class	DrawList
+ * @brief	Records draws and submits them all at once. On submit, the per frame values
+ * 			are computed once, the vertex stage of all the draws runs in parallel, and
+ * 			the results are rasterized in the order the draws were recorded, or in
+ * 			parallel when the framebuffer accepts concurrent writes.
+ * 			Meshes are referenced, not copied, so they must outlive the call to submit.
+ */
+
+class DrawList {
+public:
+	void add(const EShapeData& triangles, const dmat4& modelingMatrix, bool renderBackfaces);
+	void add(const IndexedEShapeData& mesh, const dmat4& modelingMatrix, bool renderBackfaces);
+	void add(const CompactEShapeData& mesh, const dmat4& modelingMatrix, bool renderBackfaces);
+	void clear() { commands.clear(); }
+	size_t size() const { return commands.size(); }
+	bool submit(FrameBuffer& frameBuffer, const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats, const CancelToken* cancelToken = nullptr);
+	static int minDrawsPerThread;			//!< Fewer draws than this per thread are not worth a thread.
+protected:
+	void transformRange(size_t first, size_t last, const FrameConstants& constants,
+		VertexArena& arena, const CancelToken* cancelToken) const;
+	void transformAndDrawRange(size_t first, size_t last, const FrameConstants& constants,
+		VertexArena& arena, FrameBuffer& frameBuffer, const vector<LightSourcePtr>& lights,
+		const CancelToken* cancelToken) const;
+	vector<DrawCommand> commands;			//!< Recorded draws, in order.
+	vector<VertexArena> arenas;				//!< One per thread. Reused between frames.
+};
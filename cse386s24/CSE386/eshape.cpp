@@ -7,9 +7,10 @@
  * permission is granted.
  ****************************************************/
 
-#include <fstream>
-#include <sstream>
+#include <map>
+#include <tuple>
 #include "eshape.h"
+#include "objloader.h"
  /**
   * @fn	EShapeData EShape::createEDisk(const Material &mat, int slices)
   * @brief	Creates a disk with radius 1, centered on origin and lying at z = 0
@@ -133,61 +134,267 @@ EShapeData EShape::createECheckerBoard(const Material& mat1, const Material& mat
 	return result;
 }
 
+/**
+ * @fn	EShapeData EShape::createEObj(const string &filename)
+ * @brief	Reads an OBJ file into flat shaded red plastic triangles.
+ * @param	filename	The OBJ file.
+ * @return	The triangles, or none if the file could not be read.
+ */
+
 // This code provided by Jack Duval
 EShapeData EShape::createEObj(const string& filename) {
 	EShapeData result;
-	std::ifstream in(filename);
-	if (!in.is_open()) {
-		cout << "Error: Cannot open file " << filename << endl;
+	IndexedEShapeData mesh;
+	if (!ObjLoader::load(filename, redPlastic, mesh)) {
 		return result;
 	}
 
-	// Loads all the vertices into a vector and faces into a vector
-	vector<dvec4> vertices;
-	vector<glm::ivec3> faces;
-	std::string line;
-	int faceCount = 0;
-	while (std::getline(in, line)) {
-		if (line.substr(0, 2) == "v ") {
-			std::istringstream s(line.substr(2));
-			double x, y, z;
-			s >> x >> y >> z;
-			vertices.push_back(dvec4(x, y, z, 1.0));
-		} else if (line.substr(0, 2) == "f ") {
-			// Splits the line into a vector of strings
-			std::istringstream s(line.substr(2));
-			std::vector<std::string> face;
-			std::string temp;
-			while (s >> temp) {
-				face.push_back(temp);
-			}
+	// Constructs the triangles from the vertices
+	result.reserve(mesh.indices.size());
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const dvec4& A = mesh.vertices[mesh.indices[i]].pos;
+		const dvec4& B = mesh.vertices[mesh.indices[i + 1]].pos;
+		const dvec4& C = mesh.vertices[mesh.indices[i + 2]].pos;
+		VertexData::addTriVertsAndComputeNormal(result, A, B, C, redPlastic);
+	}
+	return result;
+}
+
+/**
+ * @fn	IndexedEShapeData EShape::createIndexedEObj(const string &filename, const Material &mat)
+ * @brief	Reads an OBJ file into an indexed mesh, with the normals and texture
+ * 			coordinates it gives (see ObjLoader::load), its bounds and its meshlets.
+ * 			This is much faster than createEObj followed by createIndexedEShape.
+ * @param	filename	The OBJ file.
+ * @param	mat			Material for the whole mesh.
+ * @return	The mesh, or an empty one if the file could not be read.
+ */
+
+IndexedEShapeData EShape::createIndexedEObj(const string& filename, const Material& mat) {
+	IndexedEShapeData result;
+	if (ObjLoader::load(filename, mat, result)) {
+		result.bounds = computeBounds(result);
+		buildMeshlets(result);
+	}
+	return result;
+}
+
+/**
+ * @fn	IndexedEShapeData EShape::createIndexedEShape(const EShapeData &shape, bool smoothNormals)
+ * @brief	Converts a triangle soup into an indexed mesh by merging identical vertices.
+ * 			Normally vertices are merged only if their position, normal and material
+ * 			all match. With smoothNormals, vertices at the same position with the same
+ * 			material are merged regardless of normal, and each merged vertex gets the
+ * 			average of the face normals around it. This is what makes closed meshes
+ * 			built from flat shaded triangles share their vertices.
+ * @param	shape		 	The triangles to convert.
+ * @param	smoothNormals	True to merge vertices with different normals.
+ * @return	The indexed mesh.
+ */
+
+IndexedEShapeData EShape::createIndexedEShape(const EShapeData& shape, bool smoothNormals) {
+	typedef std::tuple<double, double, double, double> PositionKey;
+	std::map<PositionKey, vector<unsigned int>> verticesAt;
+
+	IndexedEShapeData result;
+	vector<dvec3> normalSums;
+	result.indices.reserve(shape.size());
 
-			// Faces are read as f v1/vt1/vn1 v2/vt2/vn2 v3/vt3/vn3. 
-			// We need to convert them to f v1 v2 v3
-			for (int i = 0; i < face.size(); i++) {
-				std::istringstream s(face[i]);
-				int v;
-				s >> v;
-				if (i == 0) {
-					faces.push_back(glm::ivec3(v, 0, 0));
-				} else if (i == 1) {
-					faces.at(faceCount) = glm::ivec3(faces.at(faceCount).x, v, 0);
-				} else if (i == 2) {
-					faces.at(faceCount) = glm::ivec3(faces.at(faceCount).x, faces.at(faceCount).y, v);
+	for (int i = 0; i < (int)shape.size() - 2; i += 3) {
+		// Not normalized, so larger faces count for more when averaging.
+		dvec3 faceNormal = glm::cross(shape[i + 1].pos.xyz() - shape[i].pos.xyz(),
+			shape[i + 2].pos.xyz() - shape[i].pos.xyz());
+		for (int j = i; j < i + 3; j++) {
+			const VertexData& v = shape[j];
+			vector<unsigned int>& candidates = verticesAt[PositionKey(v.pos.x, v.pos.y, v.pos.z, v.pos.w)];
+
+			unsigned int index = (unsigned int)result.vertices.size();
+			for (unsigned int c : candidates) {
+				const VertexData& other = result.vertices[c];
+				if (other.material == v.material &&
+					(smoothNormals || other.normal == v.normal)) {
+					index = c;
+					break;
 				}
 			}
-			faceCount++;
+			if (index == result.vertices.size()) {
+				candidates.push_back(index);
+				result.vertices.push_back(v);
+				normalSums.push_back(dvec3(0, 0, 0));
+			}
+			normalSums[index] += faceNormal;
+			result.indices.push_back(index);
 		}
 	}
 
-	// Constructs the triangles from the vertices
-	for (int i = 0; i < faces.size(); i++) {
-		Material mat = redPlastic;
-		dvec4 A = vertices.at(faces.at(i).x - 1);
-		dvec4 B = vertices.at(faces.at(i).y - 1);
-		dvec4 C = vertices.at(faces.at(i).z - 1);
-		VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
+	if (smoothNormals) {
+		for (unsigned int i = 0; i < result.vertices.size(); i++) {
+			if (glm::length(normalSums[i]) > 0) {
+				result.vertices[i].normal = glm::normalize(normalSums[i]);
+			}
+		}
 	}
+	result.bounds = computeBounds(shape);
+	buildMeshlets(result);
+	return result;
+}
+
+/**
+ * @fn	CompactEShapeData EShape::createCompactEShape(const IndexedEShapeData &mesh)
+ * @brief	Converts an indexed mesh to the compact vertex format.
+ * @param	mesh	The mesh to convert.
+ * @return	The compact mesh.
+ */
+
+CompactEShapeData EShape::createCompactEShape(const IndexedEShapeData& mesh) {
+	CompactEShapeData result;
+	result.vertices.reserve(mesh.vertices.size());
+	for (const VertexData& v : mesh.vertices) {
+		result.vertices.push_back(CompactVertex(v, result.materials));
+		if (result.vertices.back().materialIndex == OVERFLOW_MATERIAL) {
+			result.overflow[(unsigned int)result.vertices.size() - 1] = v.material;
+		}
+	}
+	result.indices = mesh.indices;
+	result.bounds = mesh.bounds;
+	result.meshlets = mesh.meshlets;
+	return result;
+}
+
+/**
+ * @fn	VertexData CompactEShapeData::vertexAt(unsigned int i) const
+ * @brief	Expands a vertex into a full VertexData, taking its material from the table or,
+ * 			if the table was full, from the vertex's own entry.
+ * @param	i	The vertex.
+ * @return	The equivalent VertexData.
+ */
 
+VertexData CompactEShapeData::vertexAt(unsigned int i) const {
+	VertexData result = vertices[i].toVertexData(materials);
+	if (vertices[i].materialIndex == OVERFLOW_MATERIAL) {
+		result.material = overflow.at(i);
+	}
 	return result;
-}
\ No newline at end of file
+}
+
+/**
+ * @fn	CompactEShapeData EShape::createCompactEShape(const EShapeData &shape, bool smoothNormals)
+ * @brief	Converts the output of one of the EShape generators to the compact vertex
+ * 			format, merging shared vertices (see createIndexedEShape).
+ * @param	shape		 	The triangles to convert.
+ * @param	smoothNormals	True to merge vertices with different normals.
+ * @return	The compact mesh.
+ */
+
+CompactEShapeData EShape::createCompactEShape(const EShapeData& shape, bool smoothNormals) {
+	return createCompactEShape(createIndexedEShape(shape, smoothNormals));
+}
+
+/**
+ * @fn	MeshBounds boundsOf(const vector<VertexData> &vertices, const vector<unsigned int> &indices,
+ *							unsigned int first, unsigned int count)
+ * @brief	Computes the bounds of the vertices referred to by part of an index buffer.
+ * @param	vertices	The vertices.
+ * @param	indices 	The index buffer.
+ * @param	first   	First index to include.
+ * @param	count   	Number of indices to include.
+ * @return	The bounds. Unknown if count is zero.
+ */
+
+MeshBounds boundsOf(const vector<VertexData>& vertices, const vector<unsigned int>& indices,
+	unsigned int first, unsigned int count) {
+	MeshBounds bounds;
+	if (count == 0) {
+		return bounds;
+	}
+	bounds.minCorner = bounds.maxCorner = vertices[indices[first]].pos.xyz();
+	for (unsigned int i = first; i < first + count; i++) {
+		dvec3 P = vertices[indices[i]].pos.xyz();
+		bounds.minCorner = glm::min(bounds.minCorner, P);
+		bounds.maxCorner = glm::max(bounds.maxCorner, P);
+	}
+	bounds.center = (bounds.minCorner + bounds.maxCorner) / 2.0;
+	bounds.radius = 0.0;
+	for (unsigned int i = first; i < first + count; i++) {
+		double d = glm::distance(bounds.center, vertices[indices[i]].pos.xyz());
+		bounds.radius = std::max(bounds.radius, d);
+	}
+	return bounds;
+}
+
+/**
+ * @fn	MeshBounds EShape::computeBounds(const EShapeData &shape)
+ * @brief	Computes the bounding box and bounding sphere of a shape.
+ * @param	shape	The shape.
+ * @return	The bounds, in object coordinates.
+ */
+
+MeshBounds EShape::computeBounds(const EShapeData& shape) {
+	vector<unsigned int> all(shape.size());
+	for (unsigned int i = 0; i < all.size(); i++) {
+		all[i] = i;
+	}
+	return boundsOf(shape, all, 0, (unsigned int)all.size());
+}
+
+/**
+ * @fn	MeshBounds EShape::computeBounds(const IndexedEShapeData &mesh)
+ * @brief	Computes the bounding box and bounding sphere of the triangles of a mesh.
+ * @param	mesh	The mesh.
+ * @return	The bounds, in object coordinates.
+ */
+
+MeshBounds EShape::computeBounds(const IndexedEShapeData& mesh) {
+	return boundsOf(mesh.vertices, mesh.indices, 0, (unsigned int)mesh.indices.size());
+}
+
+/**
+ * @fn	void EShape::buildMeshlets(IndexedEShapeData &mesh, int trianglesPerMeshlet)
+ * @brief	Splits the triangles of a mesh into meshlets, each made of trianglesPerMeshlet
+ * 			consecutive triangles, and computes their bounds and normal cones. The
+ * 			triangles are not reordered, so meshlets are only as compact as the order
+ * 			the triangles were generated in.
+ * @param [in,out]	mesh			   	The mesh.
+ * @param 		  	trianglesPerMeshlet	Number of triangles per meshlet.
+ */
+
+void EShape::buildMeshlets(IndexedEShapeData& mesh, int trianglesPerMeshlet) {
+	const vector<VertexData>& V = mesh.vertices;
+	const vector<unsigned int>& I = mesh.indices;
+	const unsigned int indicesPerMeshlet = 3 * std::max(trianglesPerMeshlet, 1);
+
+	mesh.meshlets.clear();
+	for (unsigned int first = 0; first + 2 < I.size(); first += indicesPerMeshlet) {
+		Meshlet m;
+		m.firstIndex = first;
+		m.indexCount = std::min(indicesPerMeshlet, (unsigned int)I.size() / 3 * 3 - first);
+		m.bounds = boundsOf(V, I, first, m.indexCount);
+
+		// The cone is built from the geometric face normals, since those decide
+		// whether a triangle is drawn, not the vertex normals.
+		vector<dvec3> faceNormals;
+		dvec3 sum(0, 0, 0);
+		for (unsigned int i = first; i < first + m.indexCount; i += 3) {
+			dvec3 n = glm::cross(V[I[i + 1]].pos.xyz() - V[I[i]].pos.xyz(),
+				V[I[i + 2]].pos.xyz() - V[I[i]].pos.xyz());
+			if (glm::length(n) > 0) {
+				faceNormals.push_back(glm::normalize(n));
+				sum += faceNormals.back();
+			}
+		}
+
+		m.coneAxis = dvec3(0, 0, 0);
+		m.coneCosAngle = -1.0;
+		m.coneSinAngle = 0.0;
+		if (glm::length(sum) > 0) {
+			m.coneAxis = glm::normalize(sum);
+			double minDot = 1.0;
+			for (const dvec3& n : faceNormals) {
+				minDot = std::min(minDot, glm::dot(m.coneAxis, n));
+			}
+			m.coneCosAngle = minDot;
+			m.coneSinAngle = std::sqrt(std::max(0.0, 1.0 - minDot * minDot));
+		}
+		mesh.meshlets.push_back(m);
+	}
+}
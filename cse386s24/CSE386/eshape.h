@@ -17,6 +17,71 @@
 
 typedef vector<VertexData> EShapeData;
 
+const int TRIANGLES_PER_MESHLET = 64;	//!< Default size of a meshlet.
+
+/**
+ * @struct	MeshBounds
+ * @brief	Bounding box and bounding sphere of a mesh or of part of one, in object
+ * 			coordinates. A negative radius means the bounds are unknown.
+ */
+
+struct MeshBounds {
+	dvec3 minCorner;		//!< Minimum corner of the axis aligned bounding box.
+	dvec3 maxCorner;		//!< Maximum corner of the axis aligned bounding box.
+	dvec3 center;			//!< Center of the bounding sphere.
+	double radius;			//!< Radius of the bounding sphere.
+	MeshBounds() : radius(-1.0) {}
+	bool isKnown() const { return radius >= 0.0; }
+};
+
+/**
+ * @struct	Meshlet
+ * @brief	A run of consecutive triangles of an indexed mesh, with its bounds and the
+ * 			cone containing all of its face normals. If the viewer is behind every
+ * 			face in the cone, the whole meshlet faces away and can be skipped.
+ */
+
+struct Meshlet {
+	unsigned int firstIndex;	//!< First index of the meshlet's triangles.
+	unsigned int indexCount;	//!< Number of indices (3 per triangle).
+	MeshBounds bounds;			//!< Bounds of the meshlet's triangles.
+	dvec3 coneAxis;				//!< Average face normal.
+	double coneCosAngle;		//!< Cosine of the cone's half angle. <= 0 if the cone is too wide to cull.
+	double coneSinAngle;		//!< Sine of the cone's half angle.
+};
+
+/**
+ * @struct	IndexedEShapeData
+ * @brief	Indexed version of EShapeData. Each distinct vertex is stored once and each
+ * 			successive triplet of indices is a triangle, so the pipeline only has to
+ * 			transform a shared vertex once.
+ */
+
+struct IndexedEShapeData {
+	vector<VertexData> vertices;	//!< The distinct vertices.
+	vector<unsigned int> indices;	//!< Index triplets, one per triangle.
+	MeshBounds bounds;				//!< Bounds of the whole mesh.
+	vector<Meshlet> meshlets;		//!< The triangles, in groups of about TRIANGLES_PER_MESHLET.
+	vector<dvec2> texCoords;		//!< (u, v) of each vertex, or empty if the mesh has none.
+	const VertexData& vertexAt(unsigned int i) const { return vertices[i]; }
+};
+
+/**
+ * @struct	CompactEShapeData
+ * @brief	Indexed mesh made of CompactVertex, with the materials shared through a
+ * 			MaterialTable. About a fifth the size of an IndexedEShapeData.
+ */
+
+struct CompactEShapeData {
+	vector<CompactVertex> vertices;	//!< The distinct vertices.
+	vector<unsigned int> indices;	//!< Index triplets, one per triangle.
+	MaterialTable materials;		//!< Materials referenced by the vertices.
+	MeshBounds bounds;				//!< Bounds of the whole mesh.
+	vector<Meshlet> meshlets;		//!< The triangles, in groups of about TRIANGLES_PER_MESHLET.
+	std::unordered_map<unsigned int, Material> overflow;	//!< Materials of OVERFLOW_MATERIAL vertices, by vertex.
+	VertexData vertexAt(unsigned int i) const;
+};
+
 /**
  * @struct	EShape
  * @brief	This class contains functions that create explicitly represented shapes.
@@ -33,4 +98,14 @@ struct EShape {
 	static EShapeData createECone(const Material& mat, int slices = DEFAULT_SLICES);
 	static EShapeData createECheckerBoard(const Material& mat1, const Material& mat2, double WIDTH, double HEIGHT, int DIV);
 	static EShapeData createEObj(const string& filename);
+	static IndexedEShapeData createIndexedEObj(const string& filename, const Material& mat = redPlastic);
+	static IndexedEShapeData createIndexedEShape(const EShapeData& shape,
+		bool smoothNormals = false);
+	static CompactEShapeData createCompactEShape(const IndexedEShapeData& mesh);
+	static MeshBounds computeBounds(const EShapeData& shape);
+	static MeshBounds computeBounds(const IndexedEShapeData& mesh);
+	static void buildMeshlets(IndexedEShapeData& mesh,
+		int trianglesPerMeshlet = TRIANGLES_PER_MESHLET);
+	static CompactEShapeData createCompactEShape(const EShapeData& shape,
+		bool smoothNormals = false);
 };
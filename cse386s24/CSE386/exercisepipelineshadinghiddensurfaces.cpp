@@ -14,6 +14,7 @@
 #include "eshape.h"
 #include "light.h"
 #include "vertexops.h"
+#include "drawlist.h"
 
 PositionalLightPtr theLight = new PositionalLight(dvec3(0, 10, 4), white);
 vector<LightSourcePtr> lights = { theLight };
@@ -24,23 +25,28 @@ dmat4& viewingMatrix = pipeMats.viewingMatrix;
 dmat4& projectionMatrix = pipeMats.projectionMatrix;
 dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-EShapeData board = EShape::createECheckerBoard(copper, polishedCopper, 10, 10, 10);
+IndexedEShapeData board = EShape::createIndexedEShape(
+	EShape::createECheckerBoard(copper, polishedCopper, 10, 10, 10));
 dvec4 A(-1, -1, 0, 1);
 dvec4 B(+1, -1, 0, 1);
 dvec4 C( 0, +1, 0, 1);
-EShapeData tri1 = EShape::createETriangle(gold, A, B, C);
-EShapeData tri2 = EShape::createETriangle(polishedCopper, A, B, C);
-EShapeData tri3 = EShape::createETriangle(cyanPlastic, A, B, C);
+EShapeData tri = EShape::createETriangle(gold, A, B, C);
+vector<dmat4> triMatrices = { T(0,2,0)*S(5,2,1),
+							T(-1, 0, 0) *Ry(-PI_3)* S(10, 3, 1),
+							T(0,1,0)*S(8,1,1)*Ry(PI_4)*Rz(PI_2) };
+vector<Material> triMaterials = { gold, polishedCopper, cyanPlastic };
 EShapeData cone = EShape::createECone(pewter, 8);
+DrawList drawList;
 	
 void renderObjects() {
 	// The rendering should work regardless of the order in which
 	// the objects are rendered.
-	VertexOps::render(frameBuffer, board, lights, glm::dmat4(), pipeMats, true);
-	VertexOps::render(frameBuffer, tri1, lights, T(0,2,0)*S(5,2,1), pipeMats, true);
-	VertexOps::render(frameBuffer, tri2, lights, T(-1, 0, 0) *Ry(-PI_3)* S(10, 3, 1), pipeMats, true);
-	VertexOps::render(frameBuffer, tri3, lights, T(0,1,0)*S(8,1,1)*Ry(PI_4)*Rz(PI_2), pipeMats, true);
-	VertexOps::render(frameBuffer, cone, lights, T(-3, 0, 3), pipeMats, true);
+	drawList.clear();
+	drawList.add(board, glm::dmat4(), true);
+	drawList.add(cone, T(-3, 0, 3), true);
+	drawList.submit(frameBuffer, lights, pipeMats);
+	VertexOps::renderInstanced(frameBuffer, tri, triMatrices, triMaterials,
+		lights, pipeMats, true);
 }
 
 static void render() {
@@ -49,6 +55,10 @@ static void render() {
 	int height = frameBuffer.getWindowHeight();
 	viewingMatrix = glm::lookAt(glm::dvec3(0, 5, 5), glm::dvec3(0, 0, 0), Y_AXIS);
 	renderObjects();
+	if (frameBuffer.isDeferred()) {
+		VertexOps::renderDeferredLighting(frameBuffer, lights, pipeMats);
+	}
+	frameBuffer.resolveConcurrentWrites();
 	frameBuffer.showAxes(viewingMatrix, projectionMatrix, viewportMatrix,
 						BoundingBoxi(0, width, 0, height));
 	frameBuffer.showColorBuffer();
@@ -79,6 +89,20 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'z':	theLight->pos.z += (isupper(key) ? INC : -INC);
 		cout << theLight->pos << endl;
 		break;
+	case 'D':
+	case 'd':	frameBuffer.setDeferredShading(!frameBuffer.isDeferred());
+		cout << "Deferred shading: " << (frameBuffer.isDeferred() ? "ON" : "OFF") << endl;
+		break;
+	case 'C':
+	case 'c':	frameBuffer.setConcurrentWrites(!frameBuffer.isConcurrent());
+		cout << "Concurrent writes: " << (frameBuffer.isConcurrent() ? "ON" : "OFF") << endl;
+		break;
+	case 'F':
+	case 'f':	frameBuffer.setDepthFormat(frameBuffer.getDepthFormat() == DepthFormat::DOUBLE ? DepthFormat::FLOAT32 :
+								frameBuffer.getDepthFormat() == DepthFormat::FLOAT32 ? DepthFormat::UNORM24 : DepthFormat::DOUBLE);
+		cout << "Depth format: " << (frameBuffer.getDepthFormat() == DepthFormat::DOUBLE ? "DOUBLE" :
+								frameBuffer.getDepthFormat() == DepthFormat::FLOAT32 ? "FLOAT32" : "UNORM24") << endl;
+		break;
 	case ESCAPE:
 		glutLeaveMainLoop();
 		break;
@@ -18,14 +18,13 @@
 #include "ishape.h"
 #include "raytracer.h"
 #include "camera.h"
-#include "image.h"
+#include "textureregistry.h"
 #include <ctime>
 #include <utility>
 #include <cctype>
 #include <ctime> 
 
 FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
-Image im("usflag.ppm");
 
 double angle = 0.0;
 bool isAnimated = true;
@@ -39,16 +38,17 @@ RayTracer rayTrace(paleGreen);
 PositionalLightPtr posLight = new PositionalLight(dvec3(10.0, 15.0, 15.0), white);
 
 void buildScene() {
+	TextureHandle flag = TextureRegistry::get("usflag.ppm", ImageFormat::RGBA8, TextureLoading::ASYNC);
 	IShapePtr cylinder1 = new ICylinderY(dvec3(0, 0, 0), 3.0, 10.0);
 	IShapePtr cylinder2 = new ICylinderY(dvec3(6, 0, -8), 2.0, 5.0);
 	IShapePtr cylinder3 = new ICylinderY(dvec3(10, 0, 0), 3.0, 5.0);
 	IShapePtr disk1 = new IDisk(dvec3(-5, 0, 6), dvec3(0, 0, 1), 3);
 	IShapePtr disk2 = new IDisk(dvec3(-9, 0, 5), dvec3(0, 0, 1), 3);
 
-	theScene.addOpaqueObject(new VisibleIShape(cylinder1, gold, &im));
+	theScene.addOpaqueObject(new VisibleIShape(cylinder1, gold, flag));
 	theScene.addOpaqueObject(new VisibleIShape(cylinder2, brass));
-	theScene.addOpaqueObject(new VisibleIShape(cylinder3, gold, &im));
-	theScene.addOpaqueObject(new VisibleIShape(disk1, gold, &im));
+	theScene.addOpaqueObject(new VisibleIShape(cylinder3, gold, flag));
+	theScene.addOpaqueObject(new VisibleIShape(disk1, gold, flag));
 	theScene.addOpaqueObject(new VisibleIShape(disk2, brass));
 
 	theScene.addLight(posLight);
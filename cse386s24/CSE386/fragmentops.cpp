@@ -100,16 +100,106 @@ void FragmentOps::processFragment(FrameBuffer& frameBuffer, const dvec3& eyePosi
 	double Z = fragment.windowPos.z;
 	int X = (int)fragment.windowPos.x;
 	int Y = (int)fragment.windowPos.y;
+	if (canWriteConcurrently(frameBuffer)) {
+		if (frameBuffer.concurrentDepthTest(X, Y, Z)) {
+			frameBuffer.testAndSetPixel(X, Y, fragment.material.ambient, Z);
+		}
+		return;
+	}
 	double oldZ = frameBuffer.getDepth(X, Y);
 	bool passDepthTest = !performDepthTest || Z < oldZ;
 
 	if (passDepthTest) {
-		color result = fragment.material.ambient;
 		if (!readonlyColorBuffer) {
-			frameBuffer.setColor(X, Y, result);
+			if (frameBuffer.isDeferred()) {
+				frameBuffer.setGBuffer(X, Y, fragment.worldPos, fragment.worldNormal,
+					fragment.material);
+			} else {
+				color result = fragment.material.ambient;
+				frameBuffer.setColor(X, Y, result);
+			}
 		}
 		if (!readonlyDepthBuffer) {
 			frameBuffer.setDepth(X, Y, Z);
 		}
 	}
 }
+
+/**
+ * @fn	bool FragmentOps::canWriteConcurrently(const FrameBuffer &frameBuffer)
+ * @brief	Determines whether fragments bound for this framebuffer go through its
+ * 			lock-free packed pixels, so they may be processed from many threads. That
+ * 			requires concurrent writes to be on and the usual depth test and writes:
+ * 			deferred shading and read-only buffers take the serial path.
+ * @param	frameBuffer	The frame buffer.
+ * @return	True if fragments may be processed concurrently.
+ */
+
+bool FragmentOps::canWriteConcurrently(const FrameBuffer& frameBuffer) {
+	return frameBuffer.isConcurrent() && !frameBuffer.isDeferred() && performDepthTest &&
+		!readonlyDepthBuffer && !readonlyColorBuffer;
+}
+
+/**
+ * @fn	color FragmentOps::applyLighting(const Fragment &fragment,
+ *										const vector<LightSourcePtr> &lights,
+ *										const Frame &eyeFrame)
+ * @brief	Computes the color of a fragment, summing the contribution of every light.
+ * 			Used by the deferred lighting pass; forward fragments keep their ambient color.
+ * @param	fragment	Fragment to be shaded.
+ * @param	lights  	Vector of lights in scene.
+ * @param	eyeFrame	The camera's frame, whose origin is the eye position.
+ * @return	The lit color of the fragment.
+ */
+
+color FragmentOps::applyLighting(const Fragment& fragment,
+	const vector<LightSourcePtr>& lights,
+	const Frame& eyeFrame) {
+	dvec3 n = glm::normalize(fragment.worldNormal);
+	color result = black;
+	for (const LightSourcePtr& light : lights) {
+		result += light->illuminate(fragment.worldPos, n, fragment.material, eyeFrame, false);
+	}
+	return glm::clamp(result, 0.0, 1.0);
+}
+
+/**
+ * @fn	void FragmentOps::processDeferredLighting(FrameBuffer &frameBuffer,
+ *												const vector<LightSourcePtr> &lights,
+ *												const Frame &eyeFrame)
+ * @brief	Lighting pass for deferred shading. Every pixel covered in the G-buffer is
+ * 			shaded exactly once, no matter how many fragments were drawn there.
+ * 			Pixels that were not covered keep the clear color.
+ * @param [in,out]	frameBuffer	The frame buffer, with a G-buffer attached.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param           eyeFrame    The camera's frame.
+ */
+
+void FragmentOps::processDeferredLighting(FrameBuffer& frameBuffer,
+	const vector<LightSourcePtr>& lights,
+	const Frame& eyeFrame) {
+	const GBuffer* gBuffer = frameBuffer.getGBuffer();
+	if (gBuffer == nullptr) {
+		return;
+	}
+
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	Fragment fragment;
+	vector<color> rowColors(W);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			int i = y * W + x;
+			unsigned short id = gBuffer->materialId[i];
+			if (id == NO_MATERIAL) {
+				rowColors[x] = frameBuffer.getColor(x, y);
+				continue;
+			}
+			fragment.worldPos = gBuffer->worldPos[i];
+			fragment.worldNormal = gBuffer->worldNormal[i];
+			fragment.material = gBuffer->getMaterial(i);
+			rowColors[x] = applyLighting(fragment, lights, eyeFrame);
+		}
+		frameBuffer.writeRow(0, y, rowColors.data(), W);
+	}
+}
@@ -64,12 +64,15 @@ public:
 		const vector<LightSourcePtr> lights,
 		const Fragment& fragment,
 		const Frame& eyeFrame);
+	static bool canWriteConcurrently(const FrameBuffer& frameBuffer);
+	static void processDeferredLighting(FrameBuffer& frameBuffer,
+		const vector<LightSourcePtr>& lights,
+		const Frame& eyeFrame);
 protected:
 	static color applyFog(const color& destColor,
 		const dvec3& eyePos, const dvec3& fragPos);
 	static color applyBlending(double alpha, const color& src, const color& dest);
 	static color applyLighting(const Fragment& fragment,
-		const dvec3& eyePositionInWorldCoords,
 		const vector<LightSourcePtr>& lights,
 		const Frame& eyeFrame);
 };
@@ -7,10 +7,16 @@
  * permission is granted.
  ****************************************************/
 
+#include <cstdint>
 #include "defs.h"
 #include "utilities.h"
 #include "framebuffer.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAMEBUFFER_SSE2
+#include <emmintrin.h>
+#endif
+
  /**
   * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
   * @brief	Constructor
@@ -18,7 +24,10 @@
   * @param	height	The height.
   */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorStorage(nullptr), colorBuffer(nullptr), depthFormat(DepthFormat::DOUBLE), depthBuffer(nullptr),
+	floatDepthBuffer(nullptr), unormDepthBuffer(nullptr), gBuffer(nullptr),
+	accumulationBuffer(nullptr), packedPixels(nullptr) {
 	setFrameBufferSize(width, height);
 }
 
@@ -28,8 +37,13 @@ FrameBuffer::FrameBuffer(const int width, const int height) {
  */
 
 FrameBuffer::~FrameBuffer() {
-	delete[] colorBuffer;
+	delete[] colorStorage;
 	delete[] depthBuffer;
+	delete[] floatDepthBuffer;
+	delete[] unormDepthBuffer;
+	delete gBuffer;
+	delete[] accumulationBuffer;
+	delete[] packedPixels;
 }
 
 /**
@@ -44,10 +58,25 @@ void FrameBuffer::setFrameBufferSize(int width, int height) {
 	this->width = width;
 	this->height = height;
 	int area = width * height;
-	delete[] colorBuffer;
-	delete[] depthBuffer;
-	colorBuffer = new GLubyte[area * BYTES_PER_PIXEL];
-	depthBuffer = new double[area];
+	delete[] colorStorage;
+	colorStorage = new GLubyte[area * BYTES_PER_PIXEL + COLOR_BUFFER_ALIGNMENT];
+	std::uintptr_t address = reinterpret_cast<std::uintptr_t>(colorStorage);
+	colorBuffer = colorStorage + (COLOR_BUFFER_ALIGNMENT - address % COLOR_BUFFER_ALIGNMENT)
+												% COLOR_BUFFER_ALIGNMENT;
+	allocateDepthBuffer();
+	if (gBuffer != nullptr) {
+		gBuffer->resize(area);
+	}
+	if (accumulationBuffer != nullptr) {
+		delete[] accumulationBuffer;
+		accumulationBuffer = new std::atomic<float>[area * ACCUMULATION_CHANNELS];
+		clearAccumulation();
+	}
+	if (packedPixels != nullptr) {
+		delete[] packedPixels;
+		packedPixels = new std::atomic<std::uint64_t>[area];
+		clearPackedPixels();
+	}
 }
 
 /**
@@ -61,6 +90,7 @@ void FrameBuffer::setClearColor(const color& clear) {
 	clearColorUB[0] = (GLubyte)(clear.r * 255.0);
 	clearColorUB[1] = (GLubyte)(clear.g * 255.0);
 	clearColorUB[2] = (GLubyte)(clear.b * 255.0);
+	clearColorUB[3] = 255;
 }
 
 /**
@@ -71,31 +101,220 @@ void FrameBuffer::setClearColor(const color& clear) {
 void FrameBuffer::clearColorAndDepthBuffers() {
 	clearColorBuffer();
 	clearDepthBuffer();
+	if (gBuffer != nullptr) {
+		gBuffer->clear();
+	}
+	if (packedPixels != nullptr) {
+		clearPackedPixels();
+	}
+}
+
+/**
+ * @fn	std::uint32_t packColor(const color &C)
+ * @brief	Converts a color to an RGBA pixel, clamping it to [0, 1].
+ * @param	C	The color.
+ * @return	The pixel, as it is laid out in memory.
+ */
+
+inline std::uint32_t packColor(const color& C) {
+	GLubyte c[BYTES_PER_PIXEL] = { (GLubyte)(glm::clamp(C.r, 0.0, 1.0) * 255),
+									(GLubyte)(glm::clamp(C.g, 0.0, 1.0) * 255),
+									(GLubyte)(glm::clamp(C.b, 0.0, 1.0) * 255),
+									255 };
+	std::uint32_t pixel;
+	std::memcpy(&pixel, c, BYTES_PER_PIXEL);
+	return pixel;
 }
 
 /**
  * @fn	void FrameBuffer::clearColorBuffer()
- * @brief	Clears the color buffer
+ * @brief	Clears the color buffer, 16 bytes at a time where SSE2 is available.
  */
 
 void FrameBuffer::clearColorBuffer() {
-	for (int y = 0; y < height; ++y) {		// can be made faster
-		for (int x = 0; x < width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width),
-											clearColorUB, BYTES_PER_PIXEL);
-		}
+	std::uint32_t pixel;
+	std::memcpy(&pixel, clearColorUB, BYTES_PER_PIXEL);
+	std::uint32_t* pixels = reinterpret_cast<std::uint32_t*>(colorBuffer);
+	const int area = width * height;
+	int i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	const __m128i fourPixels = _mm_set1_epi32((int)pixel);
+	for (; i + 4 <= area; i += 4) {
+		_mm_store_si128(reinterpret_cast<__m128i*>(pixels + i), fourPixels);
 	}
+#endif
+	std::fill(pixels + i, pixels + area, pixel);
 }
 
 /**
  * @fn	void FrameBuffer::clearDepthBuffer()
- * @brief	Clears the depth buffer
+ * @brief	Clears the depth buffer. Only the tiles' flags are reset; each tile's pixels
+ * 			are cleared when it is first written to. Pixels of edge tiles that lie
+ * 			outside the window are marked as written, since they never will be.
  */
 
 void FrameBuffer::clearDepthBuffer() {
-	int area = width * height;
-	const int SZ = area;
-	std::fill(depthBuffer, depthBuffer + SZ, 1.0);
+	for (int t = 0; t < (int)depthTiles.size(); t++) {
+		DepthTile& tile = depthTiles[t];
+		tile.needsClear = true;
+		tile.minDepth = CLEAR_DEPTH;
+		tile.maxDepth = CLEAR_DEPTH;
+		tile.written = 0;
+		int left = (t % depthTilesX) * DEPTH_TILE_SIZE;
+		int bottom = (t / depthTilesX) * DEPTH_TILE_SIZE;
+		for (int j = 0; j < DEPTH_TILE_SIZE; j++) {
+			for (int i = 0; i < DEPTH_TILE_SIZE; i++) {
+				if (left + i >= width || bottom + j >= height) {
+					tile.written |= std::uint64_t(1) << (j * DEPTH_TILE_SIZE + i);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::allocateDepthBuffer()
+ * @brief	Allocates depth storage for the current size and format, rounding the size
+ * 			up to whole tiles, and marks every tile as cleared.
+ */
+
+void FrameBuffer::allocateDepthBuffer() {
+	delete[] depthBuffer;
+	delete[] floatDepthBuffer;
+	delete[] unormDepthBuffer;
+	depthBuffer = nullptr;
+	floatDepthBuffer = nullptr;
+	unormDepthBuffer = nullptr;
+
+	depthTilesX = (width + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+	int tilesY = (height + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+	int size = depthTilesX * tilesY * DEPTH_TILE_SIZE * DEPTH_TILE_SIZE;
+	switch (depthFormat) {
+	case DepthFormat::DOUBLE:	depthBuffer = new double[size];			break;
+	case DepthFormat::FLOAT32:	floatDepthBuffer = new float[size];		break;
+	case DepthFormat::UNORM24:	unormDepthBuffer = new unsigned int[size];	break;
+	}
+	depthTiles.resize(depthTilesX * tilesY);
+	clearDepthBuffer();
+}
+
+/**
+ * @fn	void FrameBuffer::setDepthFormat(DepthFormat format)
+ * @brief	Changes how depths are stored. FLOAT32 halves the memory used (and read and
+ * 			written) by the depth test, and UNORM24 does the same with uniform precision
+ * 			over [-1, 1]. The depth buffer is cleared.
+ * @param	format	The new format.
+ */
+
+void FrameBuffer::setDepthFormat(DepthFormat format) {
+	depthFormat = format;
+	allocateDepthBuffer();
+}
+
+/**
+ * @fn	int FrameBuffer::depthIndex(int x, int y) const
+ * @brief	Index of (x, y) in the depth storage. Each tile's pixels are stored together,
+ * 			row by row.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	Index into the depth storage.
+ */
+
+int FrameBuffer::depthIndex(int x, int y) const {
+	int tile = (y / DEPTH_TILE_SIZE) * depthTilesX + x / DEPTH_TILE_SIZE;
+	return tile * DEPTH_TILE_SIZE * DEPTH_TILE_SIZE +
+		(y % DEPTH_TILE_SIZE) * DEPTH_TILE_SIZE + x % DEPTH_TILE_SIZE;
+}
+
+const double UNORM24_MAX = 16777215.0;	// 2^24 - 1
+
+/**
+ * @fn	void FrameBuffer::clearDepthTile(int tile)
+ * @brief	Fills one tile with CLEAR_DEPTH.
+ * @param	tile	The tile's index.
+ */
+
+void FrameBuffer::clearDepthTile(int tile) {
+	const int N = DEPTH_TILE_SIZE * DEPTH_TILE_SIZE;
+	int first = tile * N;
+	switch (depthFormat) {
+	case DepthFormat::DOUBLE:
+		std::fill(depthBuffer + first, depthBuffer + first + N, CLEAR_DEPTH);
+		break;
+	case DepthFormat::FLOAT32:
+		std::fill(floatDepthBuffer + first, floatDepthBuffer + first + N, (float)CLEAR_DEPTH);
+		break;
+	case DepthFormat::UNORM24:
+		std::fill(unormDepthBuffer + first, unormDepthBuffer + first + N,
+			(unsigned int)((CLEAR_DEPTH + 1.0) / 2.0 * UNORM24_MAX + 0.5));
+		break;
+	}
+	depthTiles[tile].needsClear = false;
+}
+
+/**
+ * @fn	double FrameBuffer::storedDepth(int i) const
+ * @brief	Reads the depth at an index into the depth storage, in any format.
+ * @param	i	Index into the depth storage.
+ * @return	The depth.
+ */
+
+double FrameBuffer::storedDepth(int i) const {
+	switch (depthFormat) {
+	case DepthFormat::FLOAT32:
+		return floatDepthBuffer[i];
+	case DepthFormat::UNORM24:
+		return unormDepthBuffer[i] / UNORM24_MAX * 2.0 - 1.0;
+	default:
+		return depthBuffer[i];
+	}
+}
+
+/**
+ * @fn	double FrameBuffer::tileMaxDepth(int tile) const
+ * @brief	Scans a tile for its largest depth, skipping pixels outside the window.
+ * @param	tile	The tile's index.
+ * @return	The largest depth in the tile.
+ */
+
+double FrameBuffer::tileMaxDepth(int tile) const {
+	int left = (tile % depthTilesX) * DEPTH_TILE_SIZE;
+	int bottom = (tile / depthTilesX) * DEPTH_TILE_SIZE;
+	int right = std::min(left + DEPTH_TILE_SIZE, width);
+	int top = std::min(bottom + DEPTH_TILE_SIZE, height);
+	double maxDepth = -std::numeric_limits<double>::max();
+	for (int y = bottom; y < top; y++) {
+		for (int x = left; x < right; x++) {
+			maxDepth = std::max(maxDepth, storedDepth(depthIndex(x, y)));
+		}
+	}
+	return maxDepth;
+}
+
+/**
+ * @fn	double FrameBuffer::getMaxDepth(int xMin, int yMin, int xMax, int yMax) const
+ * @brief	Returns an upper bound on the depths stored in a rectangle of pixels, using
+ * 			only the per tile ranges. A triangle whose nearest point is at or beyond
+ * 			this depth cannot pass the depth test anywhere in the rectangle.
+ * @param	xMin	Left edge of the rectangle.
+ * @param	yMin	Bottom edge of the rectangle.
+ * @param	xMax	Right edge of the rectangle.
+ * @param	yMax	Top edge of the rectangle.
+ * @return	Upper bound on the depths in the rectangle.
+ */
+
+double FrameBuffer::getMaxDepth(int xMin, int yMin, int xMax, int yMax) const {
+	int tx0 = std::max(xMin, 0) / DEPTH_TILE_SIZE;
+	int ty0 = std::max(yMin, 0) / DEPTH_TILE_SIZE;
+	int tx1 = std::min(xMax, width - 1) / DEPTH_TILE_SIZE;
+	int ty1 = std::min(yMax, height - 1) / DEPTH_TILE_SIZE;
+	double maxDepth = -std::numeric_limits<double>::max();
+	for (int ty = ty0; ty <= ty1; ty++) {
+		for (int tx = tx0; tx <= tx1; tx++) {
+			maxDepth = std::max(maxDepth, depthTiles[ty * depthTilesX + tx].maxDepth);
+		}
+	}
+	return maxDepth;
 }
 /**
  * @fn	void FrameBuffer::showColorBuffer() const
@@ -104,7 +323,7 @@ void FrameBuffer::clearDepthBuffer() {
 
 void FrameBuffer::showColorBuffer() const {
 	glRasterPos2d(-1, -1);
-	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
+	glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, colorBuffer);
 	glFlush();
 }
 
@@ -130,13 +349,57 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
 		return;
 	}
 
-	color clampedColor = glm::clamp(rgb, 0.0, 1.0);
+	std::uint32_t pixel = packColor(rgb);
+	std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width), &pixel, BYTES_PER_PIXEL);
+}
 
-	GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
-					(GLubyte)(clampedColor.g * 255),
-					(GLubyte)(clampedColor.b * 255) };
+/**
+ * @fn	void FrameBuffer::writeRow(int x, int y, const color *colors, int count)
+ * @brief	Sets the colors of count consecutive pixels in row y, starting at (x, y).
+ * 			Pixels outside the window are skipped. Much faster than calling setColor
+ * 			for each pixel.
+ * @param	x	  	The x coordinate of the first pixel.
+ * @param	y	  	The y coordinate of the row.
+ * @param	colors	The colors, count of them.
+ * @param	count 	Number of pixels to set.
+ */
 
-	std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width), c, BYTES_PER_PIXEL);
+void FrameBuffer::writeRow(int x, int y, const color* colors, int count) {
+	if (y < 0 || y >= height) {
+		return;
+	}
+	int first = std::max(x, 0);
+	int last = std::min(x + count, width);
+	std::uint32_t* row = reinterpret_cast<std::uint32_t*>(colorBuffer) + y * width;
+	for (int i = first; i < last; i++) {
+		row[i] = packColor(colors[i - x]);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::copyColors(const FrameBuffer &source, int left, int bottom, int right, int top)
+ * @brief	Copies the colors of the pixels in [left, right) x [bottom, top) from another
+ * 			framebuffer, a row at a time. Pixels outside either window are skipped.
+ * @param	source	The framebuffer to copy from.
+ * @param	left  	First column.
+ * @param	bottom	First row.
+ * @param	right 	One past the last column.
+ * @param	top   	One past the last row.
+ */
+
+void FrameBuffer::copyColors(const FrameBuffer& source, int left, int bottom, int right, int top) {
+	left = std::max(left, 0);
+	bottom = std::max(bottom, 0);
+	right = std::min(right, std::min(width, source.width));
+	top = std::min(top, std::min(height, source.height));
+	if (left >= right) {
+		return;
+	}
+	for (int y = bottom; y < top; y++) {
+		std::memcpy(colorBuffer + BYTES_PER_PIXEL * (left + y * width),
+			source.colorBuffer + BYTES_PER_PIXEL * (left + y * source.width),
+			BYTES_PER_PIXEL * (right - left));
+	}
 }
 
 /**
@@ -190,7 +453,37 @@ void FrameBuffer::setDepth(double x, double y, double depth) {
 
 void FrameBuffer::setDepth(int x, int y, double depth) {
 	if (checkInWindow(x, y)) {
-		depthBuffer[y * width + x] = depth;
+		int tileIndex = (y / DEPTH_TILE_SIZE) * depthTilesX + x / DEPTH_TILE_SIZE;
+		DepthTile& tile = depthTiles[tileIndex];
+		if (tile.needsClear) {
+			clearDepthTile(tileIndex);
+		}
+		// Track what was actually stored, so the range is exact after rounding.
+		int i = depthIndex(x, y);
+		std::uint64_t bit = std::uint64_t(1) << ((y % DEPTH_TILE_SIZE) * DEPTH_TILE_SIZE + x % DEPTH_TILE_SIZE);
+		double old = (tile.written & bit) ? storedDepth(i) : CLEAR_DEPTH;
+		double stored = depth;
+		switch (depthFormat) {
+		case DepthFormat::DOUBLE:
+			depthBuffer[i] = depth;
+			break;
+		case DepthFormat::FLOAT32:
+			floatDepthBuffer[i] = (float)depth;
+			stored = floatDepthBuffer[i];
+			break;
+		case DepthFormat::UNORM24:
+			unormDepthBuffer[i] = (unsigned int)(glm::clamp((depth + 1.0) / 2.0, 0.0, 1.0) * UNORM24_MAX + 0.5);
+			stored = unormDepthBuffer[i] / UNORM24_MAX * 2.0 - 1.0;
+			break;
+		}
+		tile.written |= bit;
+		tile.minDepth = std::min(tile.minDepth, stored);
+		if (stored >= tile.maxDepth) {
+			tile.maxDepth = stored;
+		} else if (old >= tile.maxDepth && tile.written == ~std::uint64_t(0)) {
+			// The old depth may have been the maximum; every pixel is written, so rescan.
+			tile.maxDepth = tileMaxDepth(tileIndex);
+		}
 	}
 }
 
@@ -203,11 +496,13 @@ void FrameBuffer::setDepth(int x, int y, double depth) {
 */
 
 double FrameBuffer::getDepth(int x, int y) const {
-	if (checkInWindow(x, y)) {
-		return depthBuffer[y * width + x];
-	} else {
+	if (!checkInWindow(x, y)) {
 		return 0.0;
 	}
+	if (depthTiles[(y / DEPTH_TILE_SIZE) * depthTilesX + x / DEPTH_TILE_SIZE].needsClear) {
+		return CLEAR_DEPTH;
+	}
+	return storedDepth(depthIndex(x, y));
 }
 
 /**
@@ -249,6 +544,446 @@ void FrameBuffer::setPixel(int x, int y, const color& C, double depth) {
 	setColor(x, y, C);
 }
 
+/**
+ * @fn	void GBuffer::resize(int area)
+ * @brief	Resizes the G-buffer and marks every pixel as empty.
+ * @param	area	Number of pixels in the framebuffer.
+ */
+
+void GBuffer::resize(int area) {
+	worldPos.resize(area);
+	worldNormal.resize(area);
+	materialId.resize(area);
+	clear();
+}
+
+/**
+ * @fn	void GBuffer::clear()
+ * @brief	Marks every pixel as empty. Positions and normals are left alone, since
+ * 			they are only read where a material has been written.
+ */
+
+void GBuffer::clear() {
+	std::fill(materialId.begin(), materialId.end(), NO_MATERIAL);
+	materials.clear();
+	overflow.clear();
+}
+
+/**
+ * @fn	const Material& GBuffer::getMaterial(int i) const
+ * @brief	Gets the material of a covered pixel, from the table or, once the table
+ * 			filled up, from the pixel's own entry.
+ * @param	i	The pixel, y * width + x. Its materialId must not be NO_MATERIAL.
+ * @return	The material.
+ */
+
+const Material& GBuffer::getMaterial(int i) const {
+	return materialId[i] == OVERFLOW_MATERIAL ? overflow.at(i) : materials[materialId[i]];
+}
+
+/**
+ * @fn	void FrameBuffer::setDeferredShading(bool on)
+ * @brief	Turns deferred shading on or off. When on, a G-buffer the size of the
+ * 			framebuffer is attached, and fragments record their attributes in it
+ * 			rather than being shaded immediately.
+ * @param	on	true to attach a G-buffer, false to remove it.
+ */
+
+void FrameBuffer::setDeferredShading(bool on) {
+	if (on && gBuffer == nullptr) {
+		gBuffer = new GBuffer;
+		gBuffer->resize(width * height);
+	} else if (!on) {
+		delete gBuffer;
+		gBuffer = nullptr;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setGBuffer(int x, int y, const dvec3 &worldPos,
+ *									const dvec3 &worldNormal, const Material &mat)
+ * @brief	Records the attributes of the fragment at (x, y) in the G-buffer.
+ * @param	x			The x coordinate.
+ * @param	y			The y coordinate.
+ * @param	worldPos	World position of the fragment.
+ * @param	worldNormal	World normal of the fragment.
+ * @param	mat			Material of the fragment.
+ */
+
+void FrameBuffer::setGBuffer(int x, int y, const dvec3& worldPos, const dvec3& worldNormal,
+	const Material& mat) {
+	if (gBuffer != nullptr && checkInWindow(x, y)) {
+		int i = y * width + x;
+		gBuffer->worldPos[i] = worldPos;
+		gBuffer->worldNormal[i] = worldNormal;
+		gBuffer->materialId[i] = gBuffer->materials.indexOf(mat);
+		if (gBuffer->materialId[i] == OVERFLOW_MATERIAL) {
+			gBuffer->overflow[i] = mat;
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setAccumulation(bool on)
+ * @brief	Attaches or removes a linear, floating point RGB accumulation buffer. Colors
+ * 			added with accumulate keep their full range and precision until
+ * 			resolveAccumulation writes them into the color buffer.
+ * @param	on	true to attach a cleared accumulation buffer, false to remove it.
+ */
+
+void FrameBuffer::setAccumulation(bool on) {
+	if (on && accumulationBuffer == nullptr) {
+		accumulationBuffer = new std::atomic<float>[width * height * ACCUMULATION_CHANNELS];
+		clearAccumulation();
+	} else if (!on) {
+		delete[] accumulationBuffer;
+		accumulationBuffer = nullptr;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::clearAccumulation()
+ * @brief	Sets every accumulated color and weight to zero. Clearing the color and depth
+ * 			buffers leaves the accumulation buffer alone, so it can collect samples
+ * 			across several frames or passes.
+ */
+
+void FrameBuffer::clearAccumulation() {
+	if (accumulationBuffer == nullptr) {
+		return;
+	}
+	const int N = width * height * ACCUMULATION_CHANNELS;
+	for (int i = 0; i < N; i++) {
+		accumulationBuffer[i].store(0.0f, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @fn	void atomicAdd(std::atomic<float> &total, float value)
+ * @brief	Adds value to total, safely with respect to other threads doing the same.
+ * @param [in,out]	total	The running total.
+ * @param 		  	value	The value to add.
+ */
+
+inline void atomicAdd(std::atomic<float>& total, float value) {
+	float expected = total.load(std::memory_order_relaxed);
+	while (!total.compare_exchange_weak(expected, expected + value, std::memory_order_relaxed)) {
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::accumulate(int x, int y, const color &C, double weight)
+ * @brief	Adds weight * C to the accumulated color at (x, y) and weight to its total
+ * 			weight. May be called from many threads at once, even for the same pixel.
+ * 			Does nothing if there is no accumulation buffer.
+ * @param	x	  	The x coordinate.
+ * @param	y	  	The y coordinate.
+ * @param	C	  	The color, which may lie outside [0, 1].
+ * @param	weight	The weight of the sample.
+ */
+
+void FrameBuffer::accumulate(int x, int y, const color& C, double weight) {
+	if (accumulationBuffer == nullptr || !checkInWindow(x, y)) {
+		return;
+	}
+	std::atomic<float>* pixel = accumulationBuffer + ACCUMULATION_CHANNELS * (y * width + x);
+	atomicAdd(pixel[0], (float)(C.r * weight));
+	atomicAdd(pixel[1], (float)(C.g * weight));
+	atomicAdd(pixel[2], (float)(C.b * weight));
+	atomicAdd(pixel[3], (float)weight);
+}
+
+/**
+ * @fn	float toneMapChannel(float c, ToneMap toneMap)
+ * @brief	Maps one exposed channel into [0, 1]. The comparisons are written, like the
+ * 			SSE min and max, so that a NaN becomes 0 going in and 1 coming out.
+ * @param	c	   	The exposed channel value.
+ * @param	toneMap	The operator.
+ * @return	The mapped value.
+ */
+
+inline float toneMapChannel(float c, ToneMap toneMap) {
+	c = (c > 0.0f) ? c : 0.0f;
+	switch (toneMap) {
+	case ToneMap::REINHARD:
+		c = c / (1.0f + c);
+		break;
+	case ToneMap::ACES:
+		c = (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+		break;
+	default:
+		break;
+	}
+	return (c < 1.0f) ? c : 1.0f;
+}
+
+#ifdef FRAMEBUFFER_SSE2
+/**
+ * @fn	__m128i toneMapPixel(__m128 c, ToneMap toneMap)
+ * @brief	Maps the exposed red, green and blue in the lower three lanes into [0, 1]
+ * 			and scales them to indices in the gamma table. Same math as toneMapChannel.
+ * @param	c	   	The exposed color.
+ * @param	toneMap	The operator.
+ * @return	Gamma table indices.
+ */
+
+inline __m128i toneMapPixel(__m128 c, ToneMap toneMap) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	c = _mm_max_ps(c, _mm_setzero_ps());
+	switch (toneMap) {
+	case ToneMap::REINHARD:
+		c = _mm_div_ps(c, _mm_add_ps(one, c));
+		break;
+	case ToneMap::ACES: {
+		__m128 num = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), c), _mm_set1_ps(0.03f)));
+		__m128 den = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), c),
+											_mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+		c = _mm_div_ps(num, den);
+		break;
+	}
+	default:
+		break;
+	}
+	c = _mm_min_ps(c, one);
+	return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(GAMMA_TABLE_SIZE - 1.0f)),
+													_mm_set1_ps(0.5f)));
+}
+#endif
+
+/**
+ * @fn	void FrameBuffer::resolveAccumulation(double exposure, ToneMap toneMap, double gamma)
+ * @brief	Writes the accumulated colors into the color buffer in one pass. Each pixel's
+ * 			color is divided by its total weight, multiplied by the exposure, tone mapped,
+ * 			gamma corrected and converted to bytes. Pixels with no weight keep their
+ * 			current color. Gamma correction goes through a table, so the per pixel
+ * 			work is a handful of multiplies and adds.
+ * @param	exposure	Scale applied to the linear colors before tone mapping.
+ * @param	toneMap 	Operator that maps the exposed colors into [0, 1].
+ * @param	gamma   	Display gamma; 1 leaves the tone mapped colors linear. Must be positive.
+ */
+
+void FrameBuffer::resolveAccumulation(double exposure, ToneMap toneMap, double gamma) {
+	resolveAccumulation(0, 0, width, height, exposure, toneMap, gamma);
+}
+
+/**
+ * @fn	void FrameBuffer::resolveAccumulation(int left, int bottom, int right, int top,
+ *											double exposure, ToneMap toneMap, double gamma)
+ * @brief	Resolves the accumulated colors of the pixels in [left, right) x [bottom, top)
+ * 			only, as resolveAccumulation does for the whole buffer. Threads may resolve
+ * 			separate regions at the same time.
+ * @param	left		First column.
+ * @param	bottom		First row.
+ * @param	right		One past the last column.
+ * @param	top			One past the last row.
+ * @param	exposure	Scale applied to the linear colors before tone mapping.
+ * @param	toneMap 	Operator that maps the exposed colors into [0, 1].
+ * @param	gamma   	Display gamma; 1 leaves the tone mapped colors linear. Must be positive.
+ */
+
+void FrameBuffer::resolveAccumulation(int left, int bottom, int right, int top,
+	double exposure, ToneMap toneMap, double gamma) {
+	if (accumulationBuffer == nullptr) {
+		return;
+	}
+	left = std::max(left, 0);
+	bottom = std::max(bottom, 0);
+	right = std::min(right, width);
+	top = std::min(top, height);
+	if (!(gamma > 0.0)) {
+		cout << "Gamma must be positive: " << gamma << ". Using 1." << endl;
+		gamma = 1.0;
+	}
+	GLubyte gammaTable[GAMMA_TABLE_SIZE];
+	for (int i = 0; i < GAMMA_TABLE_SIZE; i++) {
+		gammaTable[i] = (GLubyte)(std::pow(i / (GAMMA_TABLE_SIZE - 1.0), 1.0 / gamma) * 255);
+	}
+
+	for (int y = bottom; y < top; y++) {
+		for (int i = y * width + left; i < y * width + right; i++) {
+			const std::atomic<float>* accum = accumulationBuffer + ACCUMULATION_CHANNELS * i;
+			float weight = accum[3].load(std::memory_order_relaxed);
+			if (weight <= 0.0f) {
+				continue;
+			}
+			float scale = (float)exposure / weight;
+			float r = accum[0].load(std::memory_order_relaxed) * scale;
+			float g = accum[1].load(std::memory_order_relaxed) * scale;
+			float b = accum[2].load(std::memory_order_relaxed) * scale;
+			int index[4];
+#ifdef FRAMEBUFFER_SSE2
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(index),
+				toneMapPixel(_mm_setr_ps(r, g, b, 0.0f), toneMap));
+#else
+			index[0] = (int)(toneMapChannel(r, toneMap) * (GAMMA_TABLE_SIZE - 1) + 0.5f);
+			index[1] = (int)(toneMapChannel(g, toneMap) * (GAMMA_TABLE_SIZE - 1) + 0.5f);
+			index[2] = (int)(toneMapChannel(b, toneMap) * (GAMMA_TABLE_SIZE - 1) + 0.5f);
+#endif
+			GLubyte* pixel = colorBuffer + BYTES_PER_PIXEL * i;
+			pixel[0] = gammaTable[index[0]];
+			pixel[1] = gammaTable[index[1]];
+			pixel[2] = gammaTable[index[2]];
+			pixel[3] = 255;
+		}
+	}
+}
+
+/**
+ * @fn	std::uint32_t depthKey(double depth)
+ * @brief	Converts a depth to an unsigned integer with the same ordering, so that
+ * 			depths can be compared as the upper half of a packed pixel.
+ * @param	depth	The depth.
+ * @return	The key.
+ */
+
+inline std::uint32_t depthKey(double depth) {
+	float d = (float)depth;
+	std::uint32_t bits;
+	std::memcpy(&bits, &d, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+/**
+ * @fn	double keyDepth(std::uint32_t key)
+ * @brief	Inverse of depthKey.
+ * @param	key	The key.
+ * @return	The depth.
+ */
+
+inline double keyDepth(std::uint32_t key) {
+	std::uint32_t bits = (key & 0x80000000u) ? (key & 0x7FFFFFFFu) : ~key;
+	float d;
+	std::memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+/**
+ * @fn	std::uint64_t packPixel(std::uint32_t key, std::uint32_t rgba)
+ * @brief	Packs a depth key and a color into one word. Comparing packed pixels
+ * 			compares depths first and breaks ties by color.
+ * @param	key 	The depth key.
+ * @param	rgba	The color.
+ * @return	The packed pixel.
+ */
+
+inline std::uint64_t packPixel(std::uint32_t key, std::uint32_t rgba) {
+	return ((std::uint64_t)key << 32) | rgba;
+}
+
+/**
+ * @fn	std::uint64_t FrameBuffer::clearPackedPixel() const
+ * @brief	Returns the packed pixel for the clear depth and clear color.
+ * @return	The packed pixel.
+ */
+
+std::uint64_t FrameBuffer::clearPackedPixel() const {
+	std::uint32_t rgba;
+	std::memcpy(&rgba, clearColorUB, BYTES_PER_PIXEL);
+	return packPixel(depthKey(CLEAR_DEPTH), rgba);
+}
+
+/**
+ * @fn	void FrameBuffer::clearPackedPixels()
+ * @brief	Resets every packed pixel to the clear depth and clear color.
+ */
+
+void FrameBuffer::clearPackedPixels() {
+	const std::uint64_t clear = clearPackedPixel();
+	const int area = width * height;
+	for (int i = 0; i < area; i++) {
+		packedPixels[i].store(clear, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setConcurrentWrites(bool on)
+ * @brief	Turns concurrent writes on or off. When on, each pixel's depth and color are
+ * 			packed into one 64-bit word, so testAndSetPixel can do the depth test and
+ * 			the write with a single compare-and-swap. Depths are kept as floats. The
+ * 			packed pixels are reset by clearColorAndDepthBuffers and copied into the
+ * 			color and depth buffers by resolveConcurrentWrites.
+ * @param	on	true to attach cleared packed pixels, false to remove them.
+ */
+
+void FrameBuffer::setConcurrentWrites(bool on) {
+	if (on && packedPixels == nullptr) {
+		packedPixels = new std::atomic<std::uint64_t>[width * height];
+		clearPackedPixels();
+	} else if (!on) {
+		delete[] packedPixels;
+		packedPixels = nullptr;
+	}
+}
+
+/**
+ * @fn	bool FrameBuffer::concurrentDepthTest(int x, int y, double depth) const
+ * @brief	Checks whether a fragment at this depth would currently win (x, y). Lets a
+ * 			fragment that is already hidden skip shading; another thread may still
+ * 			beat it before testAndSetPixel is called.
+ * @param	x	 	The x coordinate.
+ * @param	y	 	The y coordinate.
+ * @param	depth	The depth.
+ * @return	True if the fragment is closer than what is stored.
+ */
+
+bool FrameBuffer::concurrentDepthTest(int x, int y, double depth) const {
+	if (packedPixels == nullptr || !checkInWindow(x, y)) {
+		return false;
+	}
+	std::uint64_t current = packedPixels[y * width + x].load(std::memory_order_relaxed);
+	return depthKey(depth) <= (current >> 32);
+}
+
+/**
+ * @fn	bool FrameBuffer::testAndSetPixel(int x, int y, const color &C, double depth)
+ * @brief	Atomically depth tests a fragment and, if it is closer, stores its depth and
+ * 			color. Safe to call from many threads without locks. Equal depths are
+ * 			resolved by color, so the result does not depend on the order of the calls.
+ * @param	x	 	The x coordinate.
+ * @param	y	 	The y coordinate.
+ * @param	C	 	The color.
+ * @param	depth	The depth.
+ * @return	True if the fragment was stored.
+ */
+
+bool FrameBuffer::testAndSetPixel(int x, int y, const color& C, double depth) {
+	if (packedPixels == nullptr || !checkInWindow(x, y)) {
+		return false;
+	}
+	std::atomic<std::uint64_t>& pixel = packedPixels[y * width + x];
+	const std::uint64_t packed = packPixel(depthKey(depth), packColor(C));
+	std::uint64_t current = pixel.load(std::memory_order_relaxed);
+	while (packed < current) {
+		if (pixel.compare_exchange_weak(current, packed, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	void FrameBuffer::resolveConcurrentWrites()
+ * @brief	Copies the packed pixels that have been written since the last clear into the
+ * 			color and depth buffers. Must not run while other threads are writing.
+ */
+
+void FrameBuffer::resolveConcurrentWrites() {
+	if (packedPixels == nullptr) {
+		return;
+	}
+	const std::uint64_t clear = clearPackedPixel();
+	std::uint32_t* pixels = reinterpret_cast<std::uint32_t*>(colorBuffer);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			std::uint64_t packed = packedPixels[y * width + x].load(std::memory_order_relaxed);
+			if (packed != clear) {
+				pixels[y * width + x] = (std::uint32_t)packed;
+				setDepth(x, y, keyDepth((std::uint32_t)(packed >> 32)));
+			}
+		}
+	}
+}
+
 double computeAq(const QuadricParameters& qParams, const Ray& ray) {
 	const double& A = qParams.A;
 	const double& B = qParams.B;
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include "defs.h"
 #include "ishape.h"
 #include "colorandmaterials.h"
@@ -17,13 +19,71 @@
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 #endif
 
-const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int BYTES_PER_PIXEL = 4;			//!< RGBA requires 4 bytes.
+const int COLOR_BUFFER_ALIGNMENT = 32;	//!< Byte alignment of the color buffer.
+const int DEPTH_TILE_SIZE = 8;			//!< Depth buffer tiles are DEPTH_TILE_SIZE x DEPTH_TILE_SIZE pixels.
+const double CLEAR_DEPTH = 1.0;			//!< Depth of a cleared pixel (the far plane).
+const int ACCUMULATION_CHANNELS = 4;	//!< Accumulated red, green, blue and total weight.
+const int GAMMA_TABLE_SIZE = 4096;		//!< Entries in the table used to gamma correct.
+
+/**
+ * @enum	ToneMap
+ * @brief	Operators that map accumulated HDR colors into [0, 1]. NONE clamps,
+ * 			REINHARD uses c / (1 + c) and ACES uses Narkowicz's filmic curve fit.
+ */
+
+enum class ToneMap { NONE, REINHARD, ACES };
+
+/**
+ * @enum	DepthFormat
+ * @brief	Storage formats for the depth buffer. UNORM24 covers the normalized device
+ * 			coordinate depth range, [-1, 1]; depths outside it are clamped.
+ */
+
+enum class DepthFormat { DOUBLE, FLOAT32, UNORM24 };
+
+/**
+ * @struct	DepthTile
+ * @brief	Per tile depth buffer information. A tile that needs clearing is not touched
+ * 			until something is written to it; reads return CLEAR_DEPTH in the meantime.
+ * 			Every depth stored in the tile lies within [minDepth, maxDepth]. minDepth
+ * 			only falls until the next clear. maxDepth stays at least CLEAR_DEPTH until
+ * 			every pixel of the tile in the window has been written, and is exact after.
+ */
+
+struct DepthTile {
+	bool needsClear;		//!< True if the tile's storage is stale.
+	double minDepth;		//!< Lower bound on the depths in the tile.
+	double maxDepth;		//!< Upper bound on the depths in the tile.
+	std::uint64_t written;	//!< Bit per pixel, row by row; set once written or if outside the window.
+};
+
+static_assert(DEPTH_TILE_SIZE * DEPTH_TILE_SIZE == 64, "DepthTile::written holds one bit per pixel");
+
+/**
+ * @struct	GBuffer
+ * @brief	Geometry buffer used for deferred shading. For each pixel, it holds the
+ * 			world position, world normal and material of the closest fragment, so
+ * 			lighting can be computed once per pixel after all the geometry is drawn.
+ */
+
+struct GBuffer {
+	vector<dvec3> worldPos;				//!< World position of the visible fragment.
+	vector<dvec3> worldNormal;			//!< World normal of the visible fragment.
+	vector<unsigned short> materialId;	//!< Index into materials, NO_MATERIAL if empty, or OVERFLOW_MATERIAL.
+	MaterialTable materials;			//!< Materials referenced during this frame.
+	std::unordered_map<int, Material> overflow;	//!< Materials of OVERFLOW_MATERIAL pixels, by pixel.
+	void resize(int area);
+	void clear();
+	const Material& getMaterial(int i) const;
+};
 
 /**
  * @struct	FrameBuffer
  * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
  * 			buffer stores the colors and the depth buffer stores the corresponding
- * 			depth at each pixel.
+ * 			depth at each pixel. Colors are stored as RGBA bytes, so each pixel is
+ * 			one aligned 32-bit word.
  */
 
 struct FrameBuffer {
@@ -34,6 +94,8 @@ struct FrameBuffer {
 	void setColor(int x, int y, const color& C);
 	color getClearColor();
 	color getColor(int x, int y) const;
+	void writeRow(int x, int y, const color* colors, int count);
+	void copyColors(const FrameBuffer& source, int left, int bottom, int right, int top);
 
 	void clearColorAndDepthBuffers();
 	void clearColorBuffer();
@@ -46,17 +108,57 @@ struct FrameBuffer {
 	void setDepth(int x, int y, double depth);
 	double getDepth(int x, int y) const;
 	double getDepth(double x, double y) const;
+	void setDepthFormat(DepthFormat format);
+	DepthFormat getDepthFormat() const { return depthFormat; }
+	double getMaxDepth(int xMin, int yMin, int xMax, int yMax) const;
 
 	void showAxes(int x, int y, const Ray& ray, double thickness);
 	void showAxes(const dmat4& VM, const dmat4& PM, const dmat4& VPM,
 		const BoundingBoxi& viewport);
 	void setPixel(int x, int y, const color& C, double depth);
+
+	void setAccumulation(bool on);
+	bool isAccumulating() const { return accumulationBuffer != nullptr; }
+	void accumulate(int x, int y, const color& C, double weight = 1.0);
+	void clearAccumulation();
+	void resolveAccumulation(double exposure = 1.0, ToneMap toneMap = ToneMap::NONE,
+		double gamma = 1.0);
+	void resolveAccumulation(int left, int bottom, int right, int top, double exposure = 1.0,
+		ToneMap toneMap = ToneMap::NONE, double gamma = 1.0);
+
+	void setConcurrentWrites(bool on);
+	bool isConcurrent() const { return packedPixels != nullptr; }
+	bool concurrentDepthTest(int x, int y, double depth) const;
+	bool testAndSetPixel(int x, int y, const color& C, double depth);
+	void resolveConcurrentWrites();
+
+	void setDeferredShading(bool on);
+	bool isDeferred() const { return gBuffer != nullptr; }
+	void setGBuffer(int x, int y, const dvec3& worldPos, const dvec3& worldNormal,
+		const Material& mat);
+	const GBuffer* getGBuffer() const { return gBuffer; }
 protected:
 	bool checkInWindow(int x, int y) const;
+	void allocateDepthBuffer();
+	int depthIndex(int x, int y) const;
+	void clearDepthTile(int tile);
+	double storedDepth(int i) const;
+	double tileMaxDepth(int tile) const;
+	std::uint64_t clearPackedPixel() const;
+	void clearPackedPixels();
 	int width;								//!< width of framebuffer
 	int height;								//!< height of framebuffer
 	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color, as unsigned bytes
 	color clearColor;						//!< Clear color
-	GLubyte* colorBuffer;					//!< 2D array for holding colors
-	double* depthBuffer;					//!< 2D array for holding depths
+	GLubyte* colorStorage;					//!< Allocation that holds colorBuffer
+	GLubyte* colorBuffer;					//!< Aligned 2D array of RGBA colors
+	DepthFormat depthFormat;				//!< How depths are stored
+	double* depthBuffer;					//!< Tiled array of depths (DepthFormat::DOUBLE)
+	float* floatDepthBuffer;				//!< Tiled array of depths (DepthFormat::FLOAT32)
+	unsigned int* unormDepthBuffer;			//!< Tiled array of depths (DepthFormat::UNORM24)
+	vector<DepthTile> depthTiles;			//!< Clear flag and depth range of each tile
+	int depthTilesX;						//!< Number of tiles per row
+	GBuffer* gBuffer;						//!< Deferred shading attributes (nullptr when not deferred)
+	std::atomic<float>* accumulationBuffer;	//!< Linear RGB and weight per pixel (nullptr when off)
+	std::atomic<std::uint64_t>* packedPixels;	//!< Depth key and RGBA per pixel (nullptr when off)
 };
\ No newline at end of file
@@ -7,6 +7,7 @@
  * permission is granted.
  ****************************************************/
 
+#include <chrono>
 #include <ctime>
 #include "defs.h"
 #include "io.h"
@@ -15,11 +16,11 @@
 #include "raytracer.h"
 #include "iscene.h"
 #include "light.h"
-#include "image.h"
+#include "textureregistry.h"
 #include "camera.h"
 #include "rasterization.h"
+#include "renderthread.h"
 
-Image im("usflag.ppm");
 
 int currLight = 0;
 double angle = 0.5;
@@ -51,27 +52,38 @@ vector<PositionalLightPtr> lights = {
 PositionalLightPtr posLight = lights[0];
 SpotLightPtr spotLight = (SpotLightPtr)lights[1];
 
-FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+RenderThread renderThread(WINDOW_WIDTH, WINDOW_HEIGHT, black);
 RayTracer rayTrace(paleGreen);
 IScene scene;
 
-void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
+// Runs on the render thread. The scene is only changed by updates posted to
+// renderThread, which run between frames.
+void renderFrame(FrameBuffer& frameBuffer, const CancelToken& cancelToken) {
+	auto frameStartTime = std::chrono::steady_clock::now();
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 	frameBuffer.clearColorBuffer();
 
-	scene.camera = new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, width, height);
-	rayTrace.raytraceScene(frameBuffer, 0, scene, antiAliasing);
+	scene.setCamera(new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, width, height));
+	auto publish = [](int left, int bottom, int right, int top) {
+		renderThread.publishRegion(left, bottom, right, top);
+	};
+	if (!rayTrace.raytraceImage(frameBuffer, 0, scene, antiAliasing, &cancelToken, publish)) {
+		cout << "Frame cancelled." << endl;
+		return;
+	}
 
-	frameBuffer.showColorBuffer();
-	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
-	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
+	auto frameEndTime = std::chrono::steady_clock::now();
+	double totalTimeSec = std::chrono::duration<double>(frameEndTime - frameStartTime).count();
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
 }
 
+void render() {
+	renderThread.show(true);
+}
+
 void resize(int width, int height) {
-	frameBuffer.setFrameBufferSize(width, height);
+	renderThread.resize(width, height);
 	glutPostRedisplay();
 }
 
@@ -87,12 +99,13 @@ IClosedCylinderY* closedCylinderY = new IClosedCylinderY(dvec3(4.5, 3.5, 5.0), 1
 IConeY* cone = new IConeY(dvec3(-2.5, 8.0, 5.5), 2.5, 6.0);
 
 void buildScene() {
+	TextureHandle flag = TextureRegistry::get("usflag.ppm", ImageFormat::RGBA8, TextureLoading::ASYNC);
 	scene.addOpaqueObject(new VisibleIShape(plane, tin));
 	scene.addTransparentObject(new TransparentIShape(clearPlane, red, 0.25));
 		 
 	scene.addOpaqueObject(new VisibleIShape(sphere, brass));
 
-	scene.addOpaqueObject(new VisibleIShape(cylinderY, gold, &im));
+	scene.addOpaqueObject(new VisibleIShape(cylinderY, gold, flag));
 	scene.addOpaqueObject(new VisibleIShape(disk, turquoise));
 
 	scene.addOpaqueObject(new VisibleIShape(cylinderZ, emerald));
@@ -113,22 +126,29 @@ void incrementClamp(int& v, int delta, int lo, int hi) {
 	v = glm::clamp(v + delta, lo, hi);
 }
 
+void animate() {
+	z += inc;
+	if (z <= -MAX) {
+		inc = -inc;
+	} else if (z >= MAX) {
+		inc = -inc;
+	}
+	clearPlane->a = dvec3(0, 0, z);
+	scene.shapesChanged();
+}
+
 void timer(int id) {
 	if (isAnimated) {
-		z += inc;
-		if (z <= -MAX) {
-			inc = -inc;
-		} else if (z >= MAX) {
-			inc = -inc;
-		}
+		renderThread.post(animate);
 	}
-	clearPlane->a = dvec3(0, 0, z);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
-	glutPostRedisplay();
+	if (renderThread.hasNewFrame() || renderThread.isRendering()) {
+		glutPostRedisplay();
+	}
 }
 
-void keyboard(unsigned char key, int x, int y) {
-	int W, H;
+// Runs on the render thread, between frames.
+void updateScene(unsigned char key) {
 	const double INC = 0.5;
 	switch (key) {
 	case 'A':
@@ -142,55 +162,71 @@ void keyboard(unsigned char key, int x, int y) {
 	case 'O':
 	case 'o':	lights[currLight]->isOn = !lights[currLight]->isOn;
 		cout << (lights[currLight]->isOn ? "ON" : "OFF") << endl;
+		scene.lightsChanged();
 		break;
 	case 'X':
 	case 'x': lights[currLight]->pos.x += (isupper(key) ? INC : -INC);
 		cout << lights[currLight]->pos << endl;
+		scene.lightsChanged();
 		break;
 	case 'Y':
 	case 'y': lights[currLight]->pos.y += (isupper(key) ? INC : -INC);
 		cout << lights[currLight]->pos << endl;
+		scene.lightsChanged();
 		break;
 	case 'Z':
 	case 'z': lights[currLight]->pos.z += (isupper(key) ? INC : -INC);
 		cout << lights[currLight]->pos << endl;
+		scene.lightsChanged();
 		break;
 	case 'J':
 	case 'j':	spotDirX += (isupper(key) ? INC : -INC);
 		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
 		cout << spotLight->spotDir << endl;
+		scene.lightsChanged();
 		break;
 	case 'K':
 	case 'k':	spotDirY += (isupper(key) ? INC : -INC);
 		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
 		cout << spotLight->spotDir << endl;
+		scene.lightsChanged();
 		break;
 	case 'L':
 	case 'l':	spotDirZ += (isupper(key) ? INC : -INC);
 		spotLight->setDir(spotDirX, spotDirY, spotDirZ);
 		cout << spotLight->spotDir << endl;
-		break;
-	case 'P':
-	case 'p':	isAnimated = !isAnimated;
+		scene.lightsChanged();
 		break;
 	case '+':	antiAliasing = 3;
 		cout << "Anti aliasing: " << antiAliasing << endl;
+		scene.settingsChanged();
 		break;
 	case '-':	antiAliasing = 1;
 		cout << "Anti aliasing: " << antiAliasing << endl;
+		scene.settingsChanged();
 		break;
 	case '0':
 	case '1':
 	case '2':	numReflections = key - '0';
 		cout << "Num reflections: " << numReflections << endl;
+		scene.settingsChanged();
 		break;
+	default:
+		cout << (int)key << "unmapped key pressed." << endl;
+	}
+}
+
+void keyboard(unsigned char key, int x, int y) {
+	switch (key) {
+	case 'P':
+	case 'p':
 	case 'd':	isAnimated = !isAnimated;
 		break;
 	case ESCAPE:
 		glutLeaveMainLoop();
 		break;
 	default:
-		cout << (int)key << "unmapped key pressed." << endl;
+		renderThread.post([key]() { updateScene(key); }, true);
 	}
 
 	glutPostRedisplay();
@@ -205,8 +241,11 @@ int main(int argc, char* argv[]) {
 	glutMouseFunc(mouseUtility);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	buildScene();
+	renderThread.setVersionFunction([]() { return scene.version(); });
+	renderThread.start(renderFrame);
 
 	glutMainLoop();
+	renderThread.stop();
 
 	return 0;
 }
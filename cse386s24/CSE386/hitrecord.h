@@ -15,13 +15,21 @@
 #include "image.h"
 #include "utilities.h"
 
+const int MAX_INSTANCE_NESTING = 8;	//!< Deepest nesting of instance groups that keeps texture coordinates.
+
 struct HitRecord {
 	double t;				//!< the t value where the intersection took place.
 	dvec3 interceptPt;		//!< the (x,y,z) value where the intersection took place.
 	dvec3 normal;			//!< the normal vector at the intersection point.
+	int primitive;			//!< the triangle hit, for shapes made of triangles; -1 otherwise.
+	dvec2 barycentric;		//!< weights of that triangle's second and third vertices at the hit.
+	int instancePath[MAX_INSTANCE_NESTING];	//!< the instance hit in each enclosing group, innermost first.
+	int instanceDepth;		//!< entries in instancePath; -1 if the nesting was too deep to record.
 
 	HitRecord() {
 		t = FLT_MAX;
+		primitive = -1;
+		instanceDepth = 0;
 	}
 };
 
@@ -35,6 +43,7 @@ struct OpaqueHitRecord : HitRecord {
 	Material material;		//!< the Material value of the object.
 	Image* texture;			//!< the texture associated with this object, if any (nullptr when not textured).
 	double u, v;			//!< (u,v) correpsonding to intersection point.
+	dvec2 dUV1, dUV2;		//!< (u,v) extents of the ray's footprint on the surface; zero if unknown.
 
 	/**
 	 * @fn	static HitRecord getClosest(const vector<HitRecord> &hits)
@@ -0,0 +1,200 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "iinstance.h"
+
+/**
+ * @fn	IInstance::IInstance(IShapePtr shape, const dmat4 &transform)
+ * @brief	Places a shape.
+ * @param	shape	 	The shape. It must outlive the instance.
+ * @param	transform	Affine transformation from the shape's coordinates to world
+ * 						coordinates, e.g. T(x, y, z) * R(angle, axis) * S(sx, sy, sz).
+ */
+
+IInstance::IInstance(IShapePtr shape, const dmat4& transform)
+	: IShape(), shape(shape), transform(transform), inverse(glm::inverse(transform)),
+	normalMatrix(glm::transpose(glm::inverse(dmat3(transform)))) {
+}
+
+/**
+ * @fn	void IInstance::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Intersects the shape with the ray carried into the shape's coordinates. Since
+ * 			the carried ray's direction is renormalized, t is rescaled on the way out.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit, in world coordinates; hit.t is FLT_MAX if the ray misses.
+ */
+
+void IInstance::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	dvec3 dir = (inverse * dvec4(ray.dir, 0.0)).xyz();
+	double scale = glm::length(dir);	// Shape units per world unit along the ray.
+	Ray local((inverse * dvec4(ray.origin, 1.0)).xyz(), dir);
+	local.coneWidth = ray.coneWidth * scale;
+	local.coneSpread = ray.coneSpread;
+	shape->findClosestIntersection(local, hit);
+	if (hit.t == FLT_MAX) {
+		return;
+	}
+	hit.t /= scale;
+	hit.interceptPt = ray.getPoint(hit.t);
+	hit.normal = glm::normalize(normalMatrix * hit.normal);
+}
+
+/**
+ * @fn	void IInstance::getTexCoords(const dvec3 &pt, double &u, double &v) const
+ * @brief	Gets the shape's texture coordinates at a world point.
+ * @param 		  	pt	The point.
+ * @param [in,out]	u 	The u, in (u, v).
+ * @param [in,out]	v 	The v, in (u, v).
+ */
+
+void IInstance::getTexCoords(const dvec3& pt, double& u, double& v) const {
+	shape->getTexCoords((inverse * dvec4(pt, 1.0)).xyz(), u, v);
+}
+
+/**
+ * @fn	void IInstance::getHitTexCoords(const HitRecord &hit, const dvec3 &pt, double &u, double &v) const
+ * @brief	Gets the shape's texture coordinates at a world point near a hit on it.
+ * @param 		  	hit	A hit on this instance, in world coordinates.
+ * @param 		  	pt 	The point.
+ * @param [in,out]	u  	The u, in (u, v).
+ * @param [in,out]	v  	The v, in (u, v).
+ */
+
+void IInstance::getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const {
+	HitRecord local = hit;
+	local.interceptPt = (inverse * dvec4(hit.interceptPt, 1.0)).xyz();
+	shape->getHitTexCoords(local, (inverse * dvec4(pt, 1.0)).xyz(), u, v);
+}
+
+/**
+ * @fn	BoundingBox IInstance::getBounds() const
+ * @brief	Gets the world box containing the transformed corners of the shape's box.
+ * @return	The bounds.
+ */
+
+BoundingBox IInstance::getBounds() const {
+	BoundingBox box = shape->getBounds();
+	if (!box.isBounded()) {
+		return box;
+	}
+	BoundingBox world;
+	for (int i = 0; i < 8; i++) {
+		dvec3 corner((i & 1) ? box.maxCorner.x : box.minCorner.x,
+					(i & 2) ? box.maxCorner.y : box.minCorner.y,
+					(i & 4) ? box.maxCorner.z : box.minCorner.z);
+		world.expand((transform * dvec4(corner, 1.0)).xyz());
+	}
+	return world;
+}
+
+/**
+ * @fn	IInstanceGroup::IInstanceGroup(const vector<IInstance> &instances)
+ * @brief	Constructs a group and builds the BVH over its instances. Instances of empty
+ * 			shapes are dropped.
+ * @param	instances	The instances.
+ */
+
+IInstanceGroup::IInstanceGroup(const vector<IInstance>& instances)
+	: IShape() {
+	vector<IInstance> bounded;
+	vector<BoundingBox> boxes;
+	for (const IInstance& instance : instances) {
+		BoundingBox box = instance.getBounds();
+		if (box.isEmpty()) {
+			continue;
+		}
+		if (box.isBounded()) {
+			bounded.push_back(instance);
+			boxes.push_back(box);
+		} else {
+			unbounded.push_back(instance);
+		}
+	}
+	// Testing an instance costs far more than testing a box, so every instance gets a leaf.
+	vector<unsigned int> order;
+	bvh = BVH(boxes, order, 1);
+	this->instances.reserve(order.size());
+	for (unsigned int i : order) {
+		this->instances.push_back(bounded[i]);
+	}
+}
+
+/**
+ * @fn	void IInstanceGroup::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the nearest instance the ray hits, visiting them nearest first, and adds
+ * 			it to the hit's instance path for getHitTexCoords.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit; hit.t is FLT_MAX if the ray misses.
+ */
+
+void IInstanceGroup::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	double tMax = FLT_MAX;
+	int best = -1;
+	auto test = [&](const IInstance& instance, int index) {
+		HitRecord thisHit;
+		instance.findClosestIntersection(ray, thisHit);
+		if (thisHit.t < tMax) {
+			tMax = thisHit.t;
+			hit = thisHit;
+			best = index;
+		}
+	};
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		test(unbounded[i], (int)(instances.size() + i));
+	}
+	bvh.traverse(ray, tMax, [&](unsigned int first, unsigned int count, double&) {
+		for (unsigned int i = first; i < first + count; i++) {
+			test(instances[i], (int)i);
+		}
+	});
+	if (best < 0) {
+		hit.t = FLT_MAX;
+	} else if (hit.instanceDepth >= 0 && hit.instanceDepth < MAX_INSTANCE_NESTING) {
+		hit.instancePath[hit.instanceDepth++] = best;
+	} else {
+		hit.instanceDepth = -1;
+	}
+}
+
+/**
+ * @fn	void IInstanceGroup::getHitTexCoords(const HitRecord &hit, const dvec3 &pt, double &u, double &v) const
+ * @brief	Gets the texture coordinates of the instance the hit records for this group,
+ * 			the outermost entry of its instance path.
+ * @param 		  	hit	The hit on this group.
+ * @param 		  	pt 	The point.
+ * @param [in,out]	u  	The u, in (u, v).
+ * @param [in,out]	v  	The v, in (u, v).
+ */
+
+void IInstanceGroup::getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const {
+	if (hit.instanceDepth <= 0) {
+		IShape::getTexCoords(pt, u, v);
+		return;
+	}
+	size_t index = hit.instancePath[hit.instanceDepth - 1];
+	HitRecord inner = hit;
+	inner.instanceDepth--;
+	if (index < instances.size()) {
+		instances[index].getHitTexCoords(inner, pt, u, v);
+	} else if (index - instances.size() < unbounded.size()) {
+		unbounded[index - instances.size()].getHitTexCoords(inner, pt, u, v);
+	} else {
+		IShape::getTexCoords(pt, u, v);
+	}
+}
+
+/**
+ * @fn	BoundingBox IInstanceGroup::getBounds() const
+ * @brief	Gets the box containing all of the instances.
+ * @return	The bounds; unbounded if any instance is.
+ */
+
+BoundingBox IInstanceGroup::getBounds() const {
+	return unbounded.empty() ? bvh.getBounds() : BoundingBox::unbounded();
+}
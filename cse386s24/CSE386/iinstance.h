@@ -0,0 +1,53 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "bvh.h"
+#include "ishape.h"
+
+/**
+ * @struct	IInstance
+ * @brief	A shape placed in the scene by an affine transformation. The shape itself is
+ * 			not copied, so one shape (an IMesh, say) can be placed many times. Rays are
+ * 			carried into the shape's coordinates to be intersected, and the hit is
+ * 			carried back out.
+ */
+
+struct IInstance : public IShape {
+	IShapePtr shape;		//!< The shape, in its own coordinates. Not owned.
+	dmat4 transform;		//!< Shape coordinates to world coordinates.
+	dmat4 inverse;			//!< World coordinates to shape coordinates.
+	dmat3 normalMatrix;		//!< Carries shape normals to world normals.
+	IInstance(IShapePtr shape, const dmat4& transform);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual void getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const;
+	virtual BoundingBox getBounds() const;
+};
+
+/**
+ * @struct	IInstanceGroup
+ * @brief	Many instances as one shape, sharing one material. The instances are kept in a
+ * 			BVH over their world bounds, and each instanced IMesh has its own BVH, so a
+ * 			ray only visits the instances, and the triangles, near it. Instances of
+ * 			unbounded shapes are tested separately. Groups can be instanced in turn.
+ */
+
+struct IInstanceGroup : public IShape {
+	IInstanceGroup(const vector<IInstance>& instances);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual void getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const;
+	virtual BoundingBox getBounds() const;
+	size_t size() const { return instances.size() + unbounded.size(); }
+protected:
+	vector<IInstance> instances;	//!< The bounded instances, in BVH order.
+	vector<IInstance> unbounded;	//!< The instances without bounds.
+	BVH bvh;						//!< The BVH over instances.
+};
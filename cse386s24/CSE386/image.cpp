@@ -8,112 +8,821 @@
  ****************************************************/
 
 #include <iostream>
+#include <cfloat>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
 #include <fstream>
-#include <utility>
-#include <set>
+#include <functional>
+#include <thread>
 #include "utilities.h"
 #include "image.h"
+#include "mappedfile.h"
 
-static unsigned int getNextChar(std::ifstream& input, string& str) {
-	const int N = 2000;
-	char buf;
-	input.read(&buf, 1);
-	unsigned int result = (unsigned char)buf;
-	return result;
-}
-
-static void p3(std::ifstream& input, Image& im) {
-	const int N = 100;
-	char buf[N + 1];
-
-	int maxValue;
-	input >> im.W >> im.H >> maxValue;
-	input.getline(buf, N);
-
-	im.pixels = new color[im.W * im.H];
-	color* p = im.pixels;
-	for (int row = 0; row < im.H; row++) {
-		for (int col = 0; col < im.W; col++, p++) {
-			int r, g, b;
-			input >> r >> g >> b;
-			double R = map((double)r, 0.0, (double)maxValue, 0.0, 1.0);
-			double G = map((double)g, 0.0, (double)maxValue, 0.0, 1.0);
-			double B = map((double)b, 0.0, (double)maxValue, 0.0, 1.0);
-			*p = color(R, G, B);
+const int MIN_ROWS_PER_THREAD = 64;	//!< Fewer rows than this per thread are not worth a thread.
+
+/**
+ * @struct	PPMHeader
+ * @brief	The fields of a PPM header, and where the pixel data begins.
+ */
+
+struct PPMHeader {
+	char type;			//!< '3' for P3 (ASCII), '6' for P6 (binary).
+	int W, H;			//!< Width and height.
+	int maxValue;		//!< Largest sample value, 1 to 65535.
+	size_t dataStart;	//!< Offset of the first byte of pixel data.
+};
+
+/**
+ * @fn	static void forRanges(int n, int minPerThread, const std::function<void(int, int, int)> &work)
+ * @brief	Splits [0, n) into contiguous ranges and calls work(range, first, last) on each,
+ * 			one range per thread.
+ * @param	n		   	Number of items.
+ * @param	minPerThread	Fewest items worth giving a thread.
+ * @param	work	   	Processes one range.
+ */
+
+static void forRanges(int n, int minPerThread, const std::function<void(int, int, int)>& work) {
+	int numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = std::max(1, std::min(numThreads, n / minPerThread));
+	const int perThread = (n + numThreads - 1) / numThreads;
+	vector<std::thread> workers;
+	for (int t = 1; t < numThreads; t++) {
+		workers.push_back(std::thread(work, t, std::min(n, t * perThread),
+			std::min(n, (t + 1) * perThread)));
+	}
+	work(0, 0, std::min(n, perThread));
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+/**
+ * @fn	static bool isSpace(char c)
+ * @brief	Determines whether c is PPM whitespace.
+ */
+
+static inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * @fn	static bool readHeaderValue(const char *data, size_t size, size_t &pos, int &value)
+ * @brief	Reads the next unsigned integer in a PPM header, skipping whitespace and
+ * 			comments.
+ * @param 		  	data 	The file contents.
+ * @param 		  	size 	Size of the file.
+ * @param [in,out]	pos  	Position to read from; left just after the integer.
+ * @param [out]   	value	The integer.
+ * @return	False if there was no integer, or it was too large.
+ */
+
+static bool readHeaderValue(const char* data, size_t size, size_t& pos, int& value) {
+	while (pos < size && (isSpace(data[pos]) || data[pos] == '#')) {
+		if (data[pos] == '#') {
+			while (pos < size && data[pos] != '\n') {
+				pos++;
+			}
+		} else {
+			pos++;
 		}
 	}
+	if (pos >= size || data[pos] < '0' || data[pos] > '9') {
+		return false;
+	}
+	long long result = 0;
+	while (pos < size && data[pos] >= '0' && data[pos] <= '9' && result <= INT_MAX) {
+		result = result * 10 + (data[pos++] - '0');
+	}
+	if (result > INT_MAX) {
+		return false;
+	}
+	value = (int)result;
+	return true;
+}
+
+/**
+ * @fn	static bool readHeader(const MappedFile &file, const std::string &ppmFileName, PPMHeader &header)
+ * @brief	Parses a PPM header, reporting any problem on cerr.
+ * @param 		  	file	   	The file contents.
+ * @param 		  	ppmFileName	Name of the file, for error messages.
+ * @param [out]   	header	   	The header.
+ * @return	True if the header is valid.
+ */
+
+static bool readHeader(const MappedFile& file, const std::string& ppmFileName, PPMHeader& header) {
+	const char* data = file.data();
+	const size_t size = file.size();
+	if (size < 2 || data[0] != 'P' || (data[1] != '3' && data[1] != '6')) {
+		std::cerr << "Problem with PPM file: " << ppmFileName << " is not a P3 or P6 file" << endl;
+		return false;
+	}
+	header.type = data[1];
+	size_t pos = 2;
+	if (!readHeaderValue(data, size, pos, header.W) || !readHeaderValue(data, size, pos, header.H) ||
+		!readHeaderValue(data, size, pos, header.maxValue) || pos >= size || !isSpace(data[pos])) {
+		std::cerr << "Problem with PPM file: " << ppmFileName << " has a malformed header" << endl;
+		return false;
+	}
+	if (header.W <= 0 || header.H <= 0 || (long long)header.W * header.H > INT_MAX / 3) {
+		std::cerr << "Problem with PPM file: " << ppmFileName << " has bad dimensions "
+			<< header.W << "x" << header.H << endl;
+		return false;
+	}
+	if (header.maxValue < 1 || header.maxValue > 65535) {
+		std::cerr << "Problem with PPM file: " << ppmFileName << " has maxval "
+			<< header.maxValue << "; it must be between 1 and 65535" << endl;
+		return false;
+	}
+	header.dataStart = pos + 1;
+	return true;
 }
 
-static void p6(std::ifstream& input, Image& im) {
-	const int N = 100;
-	char buf[N + 1];
-
-	int maxValue;
-	input >> im.W >> im.H >> maxValue;
-	input.getline(buf, N);
-
-	im.pixels = new color[im.W * im.H];
-	string buffer;
-	color* p = im.pixels;
-	for (int row = 0; row < im.H; row++) {
-		for (int col = 0; col < im.W; col++, p++) {
-			int r, g, b;
-			r = getNextChar(input, buffer);
-			g = getNextChar(input, buffer);
-			b = getNextChar(input, buffer);
-			double R = map((double)r, 0.0, (double)maxValue, 0.0, 1.0);
-			double G = map((double)g, 0.0, (double)maxValue, 0.0, 1.0);
-			double B = map((double)b, 0.0, (double)maxValue, 0.0, 1.0);
-			*p = color(R, G, B);
+/**
+ * @fn	static bool p3(const MappedFile &file, const PPMHeader &header, const std::string &ppmFileName, Image &im)
+ * @brief	Converts ASCII pixel data. The data is split into chunks at line breaks, one
+ * 			per thread. Each thread counts the samples in its chunk, which gives every
+ * 			chunk its first sample index, and then parses its chunk in place.
+ * @param 		  	file	   	The file contents.
+ * @param 		  	header	   	The header.
+ * @param 		  	ppmFileName	Name of the file, for error messages.
+ * @param [in,out]	im		   	The image. im.pixels must already be allocated.
+ * @return	False if the file has too few samples.
+ */
+
+static bool p3(const MappedFile& file, const PPMHeader& header, const std::string& ppmFileName,
+	Image& im) {
+	const char* data = file.data() + header.dataStart;
+	const size_t size = file.size() - header.dataStart;
+	const size_t numSamples = 3 * (size_t)im.W * im.H;
+
+	// Lines of text stand in for rows when deciding how many threads to use.
+	const int numChunks = std::max(1, std::min((int)std::max(1u, std::thread::hardware_concurrency()),
+		im.H / MIN_ROWS_PER_THREAD));
+	vector<size_t> chunkStart(numChunks + 1, size);
+	chunkStart[0] = 0;
+	for (int c = 1; c < numChunks; c++) {
+		size_t pos = std::max(chunkStart[c - 1], size * c / numChunks);
+		while (pos < size && data[pos] != '\n') {
+			pos++;
 		}
+		chunkStart[c] = std::min(size, pos + 1);
 	}
+
+	auto scan = [&](size_t begin, size_t end, size_t firstSample, bool store) {
+		size_t sample = firstSample;
+		size_t pos = begin;
+		while (pos < end) {
+			char ch = data[pos];
+			if (ch >= '0' && ch <= '9') {
+				unsigned int value = 0;
+				while (pos < end && data[pos] >= '0' && data[pos] <= '9') {
+					value = value * 10 + (data[pos++] - '0');
+				}
+				if (store && sample < numSamples) {
+					im.pixels[sample / 3][(int)(sample % 3)] = value / (double)header.maxValue;
+				}
+				sample++;
+			} else if (ch == '#') {
+				while (pos < end && data[pos] != '\n') {
+					pos++;
+				}
+			} else {
+				pos++;
+			}
+		}
+		return sample - firstSample;
+	};
+
+	vector<size_t> chunkSamples(numChunks + 1, 0);
+	forRanges(numChunks, 1, [&](int, int first, int last) {
+		for (int c = first; c < last; c++) {
+			chunkSamples[c + 1] = scan(chunkStart[c], chunkStart[c + 1], 0, false);
+		}
+	});
+	for (int c = 0; c < numChunks; c++) {
+		chunkSamples[c + 1] += chunkSamples[c];
+	}
+	if (chunkSamples[numChunks] < numSamples) {
+		std::cerr << "Problem with PPM file: " << ppmFileName << " has " << chunkSamples[numChunks]
+			<< " samples; expected " << numSamples << endl;
+		return false;
+	}
+	forRanges(numChunks, 1, [&](int, int first, int last) {
+		for (int c = first; c < last; c++) {
+			scan(chunkStart[c], chunkStart[c + 1], chunkSamples[c], true);
+		}
+	});
+	return true;
 }
 
 /**
- * @fn	Image::Image(char *ppmFileName)
+ * @fn	static bool p6(const MappedFile &file, const PPMHeader &header, const std::string &ppmFileName, Image &im)
+ * @brief	Converts binary pixel data, a band of rows per thread. Samples are one byte
+ * 			when maxval is below 256 and two bytes, most significant first, otherwise.
+ * 			One byte samples are converted with a lookup table.
+ * @param 		  	file	   	The file contents.
+ * @param 		  	header	   	The header.
+ * @param 		  	ppmFileName	Name of the file, for error messages.
+ * @param [in,out]	im		   	The image. im.pixels must already be allocated.
+ * @return	False if the file is too short.
+ */
+
+static bool p6(const MappedFile& file, const PPMHeader& header, const std::string& ppmFileName,
+	Image& im) {
+	const int bytesPerSample = header.maxValue < 256 ? 1 : 2;
+	const size_t rowBytes = 3 * (size_t)bytesPerSample * im.W;
+	const size_t available = file.size() - header.dataStart;
+	if (available < rowBytes * im.H) {
+		std::cerr << "Problem with PPM file: " << ppmFileName << " is truncated: it has "
+			<< available << " bytes of pixel data; expected " << rowBytes * im.H << endl;
+		return false;
+	}
+	const unsigned char* data =
+		reinterpret_cast<const unsigned char*>(file.data() + header.dataStart);
+	const double scale = header.maxValue;
+
+	double table[256];
+	for (int i = 0; i < 256; i++) {
+		table[i] = i / scale;
+	}
+	forRanges(im.H, MIN_ROWS_PER_THREAD, [&](int, int firstRow, int lastRow) {
+		for (int row = firstRow; row < lastRow; row++) {
+			const unsigned char* p = data + row * rowBytes;
+			color* pixel = im.pixels + (size_t)row * im.W;
+			if (bytesPerSample == 1) {
+				for (int col = 0; col < im.W; col++, p += 3) {
+					pixel[col] = color(table[p[0]], table[p[1]], table[p[2]]);
+				}
+			} else {
+				for (int col = 0; col < im.W; col++, p += 6) {
+					pixel[col] = color(((p[0] << 8) | p[1]) / scale, ((p[2] << 8) | p[3]) / scale,
+						((p[4] << 8) | p[5]) / scale);
+				}
+			}
+		}
+	});
+	return true;
+}
+
+/**
+ * @fn	Image::Image(std::string ppmFileName, ImageFormat format)
  * @brief	Constructs and image given the name of a PPM file. The file must be
- * 			P3 or P6.
+ * 			P3 or P6, with a maxval of up to 65535. If the file cannot be read, the
+ * 			problem is reported on cerr and the image is left empty: W and H are 0
+ * 			and pixels is nullptr. Mipmaps are generated once the image is loaded.
  * @param [in,out]	ppmFileName	Filename of the ppm file.
+ * @param 		  	format	   	How to store the texels.
+ */
+
+Image::Image(std::string ppmFileName, ImageFormat format)
+	: W(0), H(0), pixels(nullptr), texels(nullptr), blocks(nullptr), tilesX(0), blocksX(0) {
+	MappedFile file(ppmFileName);
+	if (!file.isOpen()) {
+		std::cerr << "Problem with PPM file: cannot read " << ppmFileName << endl;
+		return;
+	}
+	std::uint64_t sourceHash = 0;
+	if (format == ImageFormat::BC1) {
+		sourceHash = hashBytes(file.data(), file.size());
+		if (loadBlockCache(ppmFileName + BC1_CACHE_EXTENSION, sourceHash)) {
+			return;
+		}
+	}
+	PPMHeader header;
+	if (!readHeader(file, ppmFileName, header)) {
+		return;
+	}
+	W = header.W;
+	H = header.H;
+	pixels = new color[W * H];
+	bool loaded = header.type == '3' ? p3(file, header, ppmFileName, *this)
+									: p6(file, header, ppmFileName, *this);
+	if (!loaded) {
+		delete[] pixels;
+		pixels = nullptr;
+		W = H = 0;
+	} else {
+		generateMipmaps();
+		if (format == ImageFormat::RGBA8) {
+			compact();
+		} else if (format == ImageFormat::BC1) {
+			compress();
+			saveBlockCache(ppmFileName + BC1_CACHE_EXTENSION, sourceHash);
+		}
+	}
+}
+
+/**
+ * @fn	ImageFormat Image::getFormat() const
+ * @brief	Gets how the image's texels are stored.
+ * @return	The format.
+ */
+
+ImageFormat Image::getFormat() const {
+	if (texels != nullptr) {
+		return ImageFormat::RGBA8;
+	} else if (blocks != nullptr) {
+		return ImageFormat::BC1;
+	}
+	return ImageFormat::COLOR;
+}
+
+/**
+ * @struct	BlockCacheHeader
+ * @brief	Start of a BC1 cache file. It is followed by the blocks of the image and then
+ * 			of each mipmap level, in native byte order.
+ */
+
+struct BlockCacheHeader {
+	char magic[4];				//!< "BC1\0".
+	std::uint32_t version;		//!< BLOCK_CACHE_VERSION when written.
+	std::uint64_t sourceHash;	//!< Hash of the PPM file the blocks were made from, from hashBytes.
+	std::int32_t W, H;			//!< Size of the image.
+	std::int32_t numLevels;		//!< Number of levels, including the image itself.
+	std::int32_t reserved;		//!< Zero.
+};
+
+const std::uint32_t BLOCK_CACHE_VERSION = 2;	//!< Changes whenever the encoding or layout does.
+
+/**
+ * @fn	static size_t numBlocks(int w, int h)
+ * @brief	Gets the number of BC1 blocks needed for a w x h level.
+ */
+
+static size_t numBlocks(int w, int h) {
+	return (size_t)((w + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE) *
+		((h + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE);
+}
+
+/**
+ * @fn	bool Image::loadBlockCache(const std::string &cacheFileName, std::uint64_t sourceHash)
+ * @brief	Loads the image and its mipmaps from a BC1 cache, if there is one that was
+ * 			made from the same PPM file by this version of the encoder.
+ * @param	cacheFileName	Name of the cache file.
+ * @param	sourceHash   	Hash of the PPM file, from hashBytes.
+ * @return	True if the image was loaded; otherwise the image is left empty.
+ */
+
+bool Image::loadBlockCache(const std::string& cacheFileName, std::uint64_t sourceHash) {
+	MappedFile cache(cacheFileName);
+	if (!cache.isOpen() || cache.size() < sizeof(BlockCacheHeader)) {
+		return false;
+	}
+	BlockCacheHeader header;
+	std::memcpy(&header, cache.data(), sizeof(header));
+	if (std::memcmp(header.magic, "BC1", 4) != 0 || header.version != BLOCK_CACHE_VERSION ||
+		header.sourceHash != sourceHash || header.W <= 0 || header.H <= 0) {
+		return false;
+	}
+	vector<MipLevel> levels;
+	size_t expected = numBlocks(header.W, header.H);
+	for (int w = header.W, h = header.H; w > 1 || h > 1; ) {
+		MipLevel level;
+		level.W = w = std::max(1, w / 2);
+		level.H = h = std::max(1, h / 2);
+		expected += numBlocks(w, h);
+		levels.push_back(std::move(level));
+	}
+	if (header.numLevels != (int)levels.size() + 1 ||
+		cache.size() != sizeof(header) + expected * sizeof(std::uint64_t)) {
+		return false;
+	}
+	const char* data = cache.data() + sizeof(header);
+	const size_t count = numBlocks(header.W, header.H);
+	blocks = new std::uint64_t[count];
+	std::memcpy(blocks, data, count * sizeof(std::uint64_t));
+	data += count * sizeof(std::uint64_t);
+	for (MipLevel& level : levels) {
+		level.blocks.resize(numBlocks(level.W, level.H));
+		std::memcpy(level.blocks.data(), data, level.blocks.size() * sizeof(std::uint64_t));
+		data += level.blocks.size() * sizeof(std::uint64_t);
+	}
+	W = header.W;
+	H = header.H;
+	blocksX = (W + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	mipLevels = std::move(levels);
+	return true;
+}
+
+/**
+ * @fn	void Image::saveBlockCache(const std::string &cacheFileName, std::uint64_t sourceHash) const
+ * @brief	Writes a BC1 image and its mipmaps to a cache file, so that the next load can
+ * 			skip reading the PPM and encoding. A cache that cannot be written is skipped.
+ * @param	cacheFileName	Name of the cache file.
+ * @param	sourceHash   	Hash of the PPM file, from hashBytes.
+ */
+
+void Image::saveBlockCache(const std::string& cacheFileName, std::uint64_t sourceHash) const {
+	if (blocks == nullptr) {
+		return;
+	}
+	BlockCacheHeader header = { { 'B', 'C', '1', '\0' }, BLOCK_CACHE_VERSION, sourceHash,
+								W, H, getNumLevels(), 0 };
+	std::ofstream cache(cacheFileName.c_str(), std::ios::binary);
+	cache.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	cache.write(reinterpret_cast<const char*>(blocks), numBlocks(W, H) * sizeof(std::uint64_t));
+	for (const MipLevel& level : mipLevels) {
+		cache.write(reinterpret_cast<const char*>(level.blocks.data()),
+			level.blocks.size() * sizeof(std::uint64_t));
+	}
+	if (!cache) {
+		cache.close();
+		std::remove(cacheFileName.c_str());
+	}
+}
+
+/**
+ * @fn	int Image::texelIndex(int x, int y) const
+ * @brief	Finds where texel (x, y) of an RGBA8 image is stored. Tiles are stored row
+ * 			by row, and the texels within a tile row by row.
+ * @param	x	The column.
+ * @param	y	The row.
+ * @return	Index into texels.
+ */
+
+int Image::texelIndex(int x, int y) const {
+	int tile = (y / TEXEL_TILE_SIZE) * tilesX + x / TEXEL_TILE_SIZE;
+	return tile * TEXEL_TILE_SIZE * TEXEL_TILE_SIZE +
+		(y % TEXEL_TILE_SIZE) * TEXEL_TILE_SIZE + x % TEXEL_TILE_SIZE;
+}
+
+/**
+ * @fn	static std::uint32_t packTexel(const color &C)
+ * @brief	Packs a color into an RGBA8 texel, rounding each channel to 8 bits.
+ */
+
+static std::uint32_t packTexel(const color& C) {
+	std::uint32_t r = (std::uint32_t)(glm::clamp(C.r, 0.0, 1.0) * 255 + 0.5);
+	std::uint32_t g = (std::uint32_t)(glm::clamp(C.g, 0.0, 1.0) * 255 + 0.5);
+	std::uint32_t b = (std::uint32_t)(glm::clamp(C.b, 0.0, 1.0) * 255 + 0.5);
+	return r | (g << 8) | (b << 16) | (255u << 24);
+}
+
+/**
+ * @fn	static color unpackTexel(std::uint32_t texel)
+ * @brief	Unpacks an RGBA8 texel into a color.
+ */
+
+static color unpackTexel(std::uint32_t texel) {
+	return color((texel & 0xFF) / 255.0, ((texel >> 8) & 0xFF) / 255.0,
+		((texel >> 16) & 0xFF) / 255.0);
+}
+
+/**
+ * @fn	static std::uint16_t packRGB565(const color &C)
+ * @brief	Packs a color into 16 bits: 5 for red, 6 for green and 5 for blue.
+ */
+
+static std::uint16_t packRGB565(const color& C) {
+	std::uint16_t r = (std::uint16_t)(glm::clamp(C.r, 0.0, 1.0) * 31 + 0.5);
+	std::uint16_t g = (std::uint16_t)(glm::clamp(C.g, 0.0, 1.0) * 63 + 0.5);
+	std::uint16_t b = (std::uint16_t)(glm::clamp(C.b, 0.0, 1.0) * 31 + 0.5);
+	return (std::uint16_t)((r << 11) | (g << 5) | b);
+}
+
+/**
+ * @fn	static color unpackRGB565(unsigned c)
+ * @brief	Unpacks a 5:6:5 color.
+ */
+
+static color unpackRGB565(unsigned c) {
+	return color(((c >> 11) & 31) / 31.0, ((c >> 5) & 63) / 63.0, (c & 31) / 31.0);
+}
+
+/**
+ * @fn	static std::uint64_t encodeBlock(const color texels[16])
+ * @brief	Encodes a 4x4 block of texels, row by row, as BC1. The two endpoint colors
+ * 			are the extremes of the block along its principal axis; each texel gets
+ * 			the nearest of the endpoints and the two colors a third of the way
+ * 			between them.
+ * @param	texels	The block's 16 texels.
+ * @return	The block: endpoint 0 in bits 0-15, endpoint 1 in bits 16-31, and a 2 bit
+ * 			palette index per texel from bit 32 on.
  */
 
-Image::Image(std::string ppmFileName) : W(0), H(0) {
-	const int N = 100;
-	char buf1[N + 1];
-	char buf2[N + 1];
-	std::ifstream input(ppmFileName.c_str(), std::ios::binary);
-	input.getline(buf1, N);
-	int type = 3;
+static std::uint64_t encodeBlock(const color texels[BC1_BLOCK_SIZE * BC1_BLOCK_SIZE]) {
+	const int N = BC1_BLOCK_SIZE * BC1_BLOCK_SIZE;
+	color mean(0, 0, 0);
+	for (int i = 0; i < N; i++) {
+		mean += texels[i];
+	}
+	mean /= N;
+	dmat3 covariance(0.0);
+	for (int i = 0; i < N; i++) {
+		dvec3 d = texels[i] - mean;
+		covariance += glm::outerProduct(d, d);
+	}
+	dvec3 axis(1, 1, 1);
+	for (int i = 0; i < 8; i++) {
+		dvec3 next = covariance * axis;
+		if (glm::length(next) < 1e-12) {
+			break;
+		}
+		axis = glm::normalize(next);
+	}
+	double lo = 0, hi = 0;
+	for (int i = 0; i < N; i++) {
+		double t = glm::dot(texels[i] - mean, axis);
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	std::uint16_t c0 = packRGB565(mean + hi * axis);
+	std::uint16_t c1 = packRGB565(mean + lo * axis);
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+	std::uint64_t block = c0 | ((std::uint64_t)c1 << 16);
+	if (c0 == c1) {
+		return block;
+	}
+	const color a = unpackRGB565(c0), b = unpackRGB565(c1);
+	const color palette[4] = { a, b, (2.0 * a + b) / 3.0, (a + 2.0 * b) / 3.0 };
+	for (int i = 0; i < N; i++) {
+		int best = 0;
+		double bestDistance = DBL_MAX;
+		for (int j = 0; j < 4; j++) {
+			dvec3 d = texels[i] - palette[j];
+			double distance = glm::dot(d, d);
+			if (distance < bestDistance) {
+				best = j;
+				bestDistance = distance;
+			}
+		}
+		block |= (std::uint64_t)best << (32 + 2 * i);
+	}
+	return block;
+}
+
+/**
+ * @fn	static color decodeTexel(std::uint64_t block, int x, int y)
+ * @brief	Decodes one texel of a BC1 block, without decoding the rest.
+ * @param	block	The block.
+ * @param	x	 	The texel's column within the block.
+ * @param	y	 	The texel's row within the block.
+ * @return	The color.
+ */
+
+static color decodeTexel(std::uint64_t block, int x, int y) {
+	// Weights of the two endpoints for each palette index, in four and three color mode.
+	static const double WEIGHTS[2][4][2] = {
+		{ { 1, 0 }, { 0, 1 }, { 2 / 3.0, 1 / 3.0 }, { 1 / 3.0, 2 / 3.0 } },
+		{ { 1, 0 }, { 0, 1 }, { 0.5, 0.5 }, { 0, 0 } } };
+	unsigned c0 = (unsigned)(block & 0xFFFF);
+	unsigned c1 = (unsigned)((block >> 16) & 0xFFFF);
+	int index = (int)((block >> (32 + 2 * (y * BC1_BLOCK_SIZE + x))) & 3);
+	const double* w = WEIGHTS[c0 > c1 ? 0 : 1][index];
+	return w[0] * unpackRGB565(c0) + w[1] * unpackRGB565(c1);
+}
+
+/**
+ * @fn	static vector<std::uint64_t> encodeBlocks(const vector<color> &texels, int w, int h)
+ * @brief	Encodes a w x h level, stored row by row, as BC1 blocks, stored row by row.
+ * 			Blocks that hang over the right or top edge repeat the edge texels.
+ */
+
+static vector<std::uint64_t> encodeBlocks(const vector<color>& texels, int w, int h) {
+	const int blocksX = (w + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	const int blocksY = (h + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	vector<std::uint64_t> blocks(blocksX * blocksY);
+	forRanges(blocksY, MIN_ROWS_PER_THREAD / BC1_BLOCK_SIZE, [&](int, int first, int last) {
+		color block[BC1_BLOCK_SIZE * BC1_BLOCK_SIZE];
+		for (int by = first; by < last; by++) {
+			for (int bx = 0; bx < blocksX; bx++) {
+				for (int y = 0; y < BC1_BLOCK_SIZE; y++) {
+					int row = std::min(by * BC1_BLOCK_SIZE + y, h - 1);
+					for (int x = 0; x < BC1_BLOCK_SIZE; x++) {
+						int col = std::min(bx * BC1_BLOCK_SIZE + x, w - 1);
+						block[y * BC1_BLOCK_SIZE + x] = texels[row * w + col];
+					}
+				}
+				blocks[by * blocksX + bx] = encodeBlock(block);
+			}
+		}
+	});
+	return blocks;
+}
+
+/**
+ * @fn	void Image::compact()
+ * @brief	Converts the image to ImageFormat::RGBA8, rounding each channel to 8 bits.
+ * 			Texels take a sixth of the memory. Images loaded from 8 bit files look
+ * 			exactly the same. Mipmaps are converted too.
+ */
+
+void Image::compact() {
+	if (pixels == nullptr) {
+		return;
+	}
+	tilesX = (W + TEXEL_TILE_SIZE - 1) / TEXEL_TILE_SIZE;
+	const int tilesY = (H + TEXEL_TILE_SIZE - 1) / TEXEL_TILE_SIZE;
+	texels = new std::uint32_t[tilesX * tilesY * TEXEL_TILE_SIZE * TEXEL_TILE_SIZE]();
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			texels[texelIndex(x, y)] = packTexel(pixels[y * W + x]);
+		}
+	}
+	delete[] pixels;
 	pixels = nullptr;
+	for (MipLevel& level : mipLevels) {
+		level.texels.resize(level.pixels.size());
+		for (size_t i = 0; i < level.pixels.size(); i++) {
+			level.texels[i] = packTexel(level.pixels[i]);
+		}
+		vector<color>().swap(level.pixels);
+	}
+}
+
+/**
+ * @fn	void Image::compress()
+ * @brief	Converts the image to ImageFormat::BC1: each 4x4 block of texels is stored
+ * 			in 8 bytes, as two 5:6:5 colors and a 2 bit index per texel choosing
+ * 			between them and two colors in between. Texels take half a byte, an
+ * 			eighth of RGBA8. Smooth areas look the same; blocks holding more than two
+ * 			distinct colors lose some detail. Mipmaps are converted too.
+ */
 
-	while (input.peek() == '#') {
-		input.getline(buf2, N);
+void Image::compress() {
+	if (pixels == nullptr) {
+		return;
 	}
-	string header(buf1);
-	header = header.substr(0, 2);
-	if (header == "P3") {
-		p3(input, *this);
-	} else if (header == "P6") {
-		p6(input, *this);
-	} else {
-		std::cerr << "Problem with PPM file: " << ppmFileName << "(" << header << ")" << endl;
+	blocksX = (W + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	vector<std::uint64_t> encoded = encodeBlocks(vector<color>(pixels, pixels + W * H), W, H);
+	blocks = new std::uint64_t[encoded.size()];
+	std::copy(encoded.begin(), encoded.end(), blocks);
+	delete[] pixels;
+	pixels = nullptr;
+	for (MipLevel& level : mipLevels) {
+		level.blocks = encodeBlocks(level.pixels, level.W, level.H);
+		vector<color>().swap(level.pixels);
+	}
+}
+
+/**
+ * @fn	color Image::getTexel(int x, int y) const
+ * @brief	Gets the color of texel (x, y), which must be within the image.
+ * @param	x	The column.
+ * @param	y	The row.
+ * @return	The color.
+ */
+
+color Image::getTexel(int x, int y) const {
+	if (pixels != nullptr) {
+		return pixels[y * W + x];
+	} else if (texels != nullptr) {
+		return unpackTexel(texels[texelIndex(x, y)]);
+	}
+	return decodeTexel(blocks[(y / BC1_BLOCK_SIZE) * blocksX + x / BC1_BLOCK_SIZE],
+		x % BC1_BLOCK_SIZE, y % BC1_BLOCK_SIZE);
+}
+
+/**
+ * @fn	void Image::generateMipmaps()
+ * @brief	Builds the mipmap chain: each level averages 2x2 blocks of the level before
+ * 			it, down to a single texel. Odd sized levels repeat their last row or
+ * 			column. Together the levels take a third more memory than the image.
+ */
+
+void Image::generateMipmaps() {
+	mipLevels.clear();
+	if (!isLoaded()) {
 		return;
 	}
+	const ImageFormat format = getFormat();
+	int w = W, h = H;
+	while (w > 1 || h > 1) {
+		MipLevel level;
+		level.W = std::max(1, w / 2);
+		level.H = std::max(1, h / 2);
+		vector<color> averages(level.W * level.H);
+		const int from = getNumLevels() - 1;
+		forRanges(level.H, MIN_ROWS_PER_THREAD, [&](int, int first, int last) {
+			for (int y = first; y < last; y++) {
+				int y0 = 2 * y, y1 = std::min(2 * y + 1, h - 1);
+				for (int x = 0; x < level.W; x++) {
+					int x0 = 2 * x, x1 = std::min(2 * x + 1, w - 1);
+					averages[y * level.W + x] = (getTexel(from, x0, y0) + getTexel(from, x1, y0) +
+						getTexel(from, x0, y1) + getTexel(from, x1, y1)) / 4.0;
+				}
+			}
+		});
+		if (format == ImageFormat::RGBA8) {
+			level.texels.resize(averages.size());
+			for (size_t i = 0; i < averages.size(); i++) {
+				level.texels[i] = packTexel(averages[i]);
+			}
+		} else if (format == ImageFormat::BC1) {
+			level.blocks = encodeBlocks(averages, level.W, level.H);
+		} else {
+			level.pixels = std::move(averages);
+		}
+		w = level.W;
+		h = level.H;
+		mipLevels.push_back(std::move(level));
+	}
+}
+
+/**
+ * @fn	color Image::getTexel(int level, int x, int y) const
+ * @brief	Gets the color of texel (x, y) of a mipmap level. The texel must be within
+ * 			the level.
+ * @param	level	The level; 0 is the image itself.
+ * @param	x	 	The column.
+ * @param	y	 	The row.
+ * @return	The color.
+ */
+
+color Image::getTexel(int level, int x, int y) const {
+	if (level == 0) {
+		return getTexel(x, y);
+	}
+	const MipLevel& mip = mipLevels[level - 1];
+	if (!mip.pixels.empty()) {
+		return mip.pixels[y * mip.W + x];
+	} else if (!mip.texels.empty()) {
+		return unpackTexel(mip.texels[y * mip.W + x]);
+	}
+	const int mipBlocksX = (mip.W + BC1_BLOCK_SIZE - 1) / BC1_BLOCK_SIZE;
+	return decodeTexel(mip.blocks[(y / BC1_BLOCK_SIZE) * mipBlocksX + x / BC1_BLOCK_SIZE],
+		x % BC1_BLOCK_SIZE, y % BC1_BLOCK_SIZE);
+}
 
-	input.close();
+/**
+ * @fn	color Image::getBilinear(int level, double u, double v) const
+ * @brief	Interpolates between the four texels of a level whose centers surround (u, v).
+ * 			Coordinates outside the level use its edge texels.
+ * @param	level	The level; 0 is the image itself.
+ * @param	u	 	The u in (u, v).
+ * @param	v	 	The v in (u, v).
+ * @return	The interpolated color.
+ */
+
+color Image::getBilinear(int level, double u, double v) const {
+	int w = level == 0 ? W : mipLevels[level - 1].W;
+	int h = level == 0 ? H : mipLevels[level - 1].H;
+	double x = u * w - 0.5;
+	double y = v * h - 0.5;
+	double fx = x - std::floor(x);
+	double fy = y - std::floor(y);
+	int x0 = glm::clamp((int)std::floor(x), 0, w - 1);
+	int y0 = glm::clamp((int)std::floor(y), 0, h - 1);
+	int x1 = glm::clamp((int)std::floor(x) + 1, 0, w - 1);
+	int y1 = glm::clamp((int)std::floor(y) + 1, 0, h - 1);
+	color bottom = glm::mix(getTexel(level, x0, y0), getTexel(level, x1, y0), fx);
+	color top = glm::mix(getTexel(level, x0, y1), getTexel(level, x1, y1), fx);
+	return glm::mix(bottom, top, fy);
+}
+
+/**
+ * @fn	color Image::getPixelUV(double u, double v, const dvec2 &dUV1, const dvec2 &dUV2) const
+ * @brief	Gets the filtered color of the area around (u, v) covered by a ray's footprint.
+ * 			The level of detail is chosen so that the longer axis of the footprint spans
+ * 			about one texel, and the two nearest levels are sampled bilinearly and
+ * 			blended (trilinear filtering). A zero footprint samples the image itself
+ * 			bilinearly. An empty image is black.
+ * @param	u   	The u in (u, v).
+ * @param	v   	The v in (u, v).
+ * @param	dUV1	One axis of the footprint, in (u, v).
+ * @param	dUV2	The other axis of the footprint, in (u, v).
+ * @return	The filtered color.
+ */
+
+color Image::getPixelUV(double u, double v, const dvec2& dUV1, const dvec2& dUV2) const {
+	if (!isLoaded()) {
+		return black;
+	}
+	const dvec2 size(W, H);
+	double texelsCovered = std::max(glm::length(dUV1 * size), glm::length(dUV2 * size));
+	double lod = texelsCovered > 1 ? std::log2(texelsCovered) : 0;
+	const int maxLevel = getNumLevels() - 1;
+	if (lod >= maxLevel) {
+		return getBilinear(maxLevel, u, v);
+	}
+	int level = (int)lod;
+	double blend = lod - level;
+	color C = getBilinear(level, u, v);
+	if (blend > 0) {
+		C = glm::mix(C, getBilinear(level + 1, u, v), blend);
+	}
+	return C;
 }
 
 /**
  * @fn	color Image::getPixelUV(double u, double v) const
  * @brief	Gets the color that corresponds to the coordinate (u, v). This is
  * 			done by finding the texel whose center is closest to (u, v). In the
- * 			event of a tie, picks one of these.
+ * 			event of a tie, picks one of these. An empty image is black.
  * @param	u	The u in (u, v).
  * @param	v	The v in (u, v).
  * @return	The color corresponding to the position (u, v).
  */
 
 color Image::getPixelUV(double u, double v) const {
+	if (!isLoaded()) {
+		return black;
+	}
 	int x = glm::clamp((int)(W * u), 0, W - 1);
 	int y = glm::clamp((int)(H * v), 0, H - 1);
-	return pixels[y * W + x];
+	return getTexel(x, y);
 }
@@ -9,9 +9,38 @@
 
 #pragma once
 #include <memory>
+#include <cstdint>
+#include <string>
 #include "defs.h"
 #include "colorandmaterials.h"
 
+const int TEXEL_TILE_SIZE = 8;	//!< RGBA8 images are stored in tiles this many texels square.
+const int BC1_BLOCK_SIZE = 4;	//!< BC1 images are encoded in blocks this many texels square.
+const char BC1_CACHE_EXTENSION[] = ".bc1";	//!< Appended to a PPM's name to name its BC1 cache.
+
+/**
+ * @enum	ImageFormat
+ * @brief	How an image's texels are stored. COLOR keeps three doubles per texel, in
+ * 			rows. RGBA8 keeps one byte per channel, 4 bytes per texel, in square tiles
+ * 			so that texels near each other in (u, v) are near each other in memory.
+ * 			BC1 keeps 8 bytes per 4x4 block of texels, in rows of blocks; it is lossy.
+ */
+
+enum class ImageFormat { COLOR, RGBA8, BC1 };
+
+/**
+ * @struct	MipLevel
+ * @brief	One reduced copy of an image, half the size of the one before it. Texels are
+ * 			stored row by row, in the same format as the image.
+ */
+
+struct MipLevel {
+	int W, H;
+	vector<color> pixels;			//!< Texels (ImageFormat::COLOR).
+	vector<std::uint32_t> texels;	//!< Packed texels (ImageFormat::RGBA8).
+	vector<std::uint64_t> blocks;	//!< Encoded blocks (ImageFormat::BC1), in rows of blocks.
+};
+
  /**
   * @struct	Image
   * @brief	Represents a rectangular RGB image.
@@ -19,8 +48,27 @@
 
 struct Image {
 	int W, H;
-	color* pixels;
-	Image(std::string ppmFileName);
-	~Image() { delete[] pixels; }
+	color* pixels;				//!< Texels, row by row (ImageFormat::COLOR); otherwise nullptr.
+	std::uint32_t* texels;		//!< Tiled RGBA8 texels (ImageFormat::RGBA8); otherwise nullptr.
+	std::uint64_t* blocks;		//!< BC1 blocks, in rows of blocks (ImageFormat::BC1); otherwise nullptr.
+	Image(std::string ppmFileName, ImageFormat format = ImageFormat::COLOR);
+	~Image() { delete[] pixels; delete[] texels; delete[] blocks; }
+	bool isLoaded() const { return pixels != nullptr || texels != nullptr || blocks != nullptr; }
+	ImageFormat getFormat() const;
+	void compact();
+	void compress();
+	void generateMipmaps();
+	int getNumLevels() const { return isLoaded() ? 1 + (int)mipLevels.size() : 0; }
+	color getTexel(int x, int y) const;
+	color getTexel(int level, int x, int y) const;
 	color getPixelUV(double u, double v) const;
+	color getPixelUV(double u, double v, const dvec2& dUV1, const dvec2& dUV2) const;
+protected:
+	int texelIndex(int x, int y) const;
+	color getBilinear(int level, double u, double v) const;
+	bool loadBlockCache(const std::string& cacheFileName, std::uint64_t sourceHash);
+	void saveBlockCache(const std::string& cacheFileName, std::uint64_t sourceHash) const;
+	int tilesX;					//!< Number of tiles per row of an RGBA8 image.
+	int blocksX;				//!< Number of blocks per row of a BC1 image.
+	vector<MipLevel> mipLevels;	//!< Levels 1 and up; level 0 is the image itself.
 };
@@ -0,0 +1,160 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "imesh.h"
+
+/**
+ * @fn	IMesh::IMesh(const IndexedEShapeData &mesh)
+ * @brief	Constructs a mesh shape from an indexed mesh, building its BVH.
+ * @param	mesh	The mesh, such as one made by EShape::createIndexedEObj. Materials are
+ * 					ignored; the VisibleIShape holding the mesh supplies one.
+ */
+
+IMesh::IMesh(const IndexedEShapeData& mesh)
+	: IShape(), indices(mesh.indices) {
+	vector<dvec3> positions(mesh.vertices.size());
+	normals.resize(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		positions[i] = mesh.vertices[i].pos.xyz();
+		normals[i] = mesh.vertices[i].normal;
+	}
+	if (mesh.texCoords.size() == mesh.vertices.size()) {
+		texCoords = mesh.texCoords;
+	}
+	setUp(positions);
+}
+
+/**
+ * @fn	IMesh::IMesh(const MeshCache &cache)
+ * @brief	Constructs a mesh shape from an open mesh cache. The BVH stored in the cache is
+ * 			used if there is one; otherwise one is built.
+ * @param	cache	The cache.
+ */
+
+IMesh::IMesh(const MeshCache& cache)
+	: IShape(), indices(cache.getIndices(), cache.getIndices() + cache.getIndexCount()) {
+	const unsigned int vertexCount = cache.getVertexCount();
+	vector<dvec3> positions(vertexCount);
+	normals.resize(vertexCount);
+	for (unsigned int i = 0; i < vertexCount; i++) {
+		positions[i] = dvec3(cache.getPositions()[i]);
+		normals[i] = dvec3(cache.getNormals()[i]);
+	}
+	if (cache.getTexCoords() != nullptr) {
+		texCoords.resize(vertexCount);
+		for (unsigned int i = 0; i < vertexCount; i++) {
+			texCoords[i] = dvec2(cache.getTexCoords()[i]);
+		}
+	}
+	if (cache.getBVHNodeCount() > 0 && cache.getBVHNodeSize() == sizeof(BVHNode)) {
+		bvh = BVH(static_cast<const BVHNode*>(cache.getBVHNodes()), cache.getBVHNodeCount());
+		if (!bvh.isValid(cache.getIndexCount() / 3)) {
+			bvh = BVH();
+		}
+	}
+	setUp(positions);
+}
+
+/**
+ * @fn	void IMesh::setUp(const vector<dvec3> &positions)
+ * @brief	Builds the BVH, unless there already is one, and the triangles in its order.
+ * @param	positions	The vertex positions.
+ */
+
+void IMesh::setUp(const vector<dvec3>& positions) {
+	if (bvh.isEmpty()) {
+		bvh = BVH::forTriangles(positions, indices);
+	}
+	triangles.resize(indices.size() / 3);
+	for (size_t i = 0; i < triangles.size(); i++) {
+		const dvec3& a = positions[indices[3 * i]];
+		triangles[i].a = a;
+		triangles[i].e1 = positions[indices[3 * i + 1]] - a;
+		triangles[i].e2 = positions[indices[3 * i + 2]] - a;
+	}
+}
+
+/**
+ * @fn	void IMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the nearest triangle the ray hits, testing each candidate the BVH
+ * 			yields with the Moller-Trumbore algorithm. The normal is interpolated from
+ * 			the triangle's vertex normals.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit; hit.t is FLT_MAX if the ray misses.
+ */
+
+void IMesh::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	double tMax = FLT_MAX;
+	unsigned int best = 0;
+	double bestB1 = 0, bestB2 = 0;
+	bool found = false;
+	bvh.traverse(ray, tMax, [&](unsigned int first, unsigned int count, double& tMax) {
+		for (unsigned int i = first; i < first + count; i++) {
+			const MeshTriangle& tri = triangles[i];
+			double t, b1, b2;
+			if (intersectTriangle(ray, tri.a, tri.e1, tri.e2, tMax, t, b1, b2)) {
+				tMax = t;
+				best = i;
+				bestB1 = b1;
+				bestB2 = b2;
+				found = true;
+			}
+		}
+	});
+	if (!found) {
+		hit.t = FLT_MAX;
+		return;
+	}
+	const MeshTriangle& tri = triangles[best];
+	hit.t = tMax;
+	hit.interceptPt = ray.origin + tMax * ray.dir;
+	dvec3 n = (1 - bestB1 - bestB2) * normals[indices[3 * best]] +
+		bestB1 * normals[indices[3 * best + 1]] + bestB2 * normals[indices[3 * best + 2]];
+	if (glm::length(n) < EPSILON) {
+		n = glm::cross(tri.e1, tri.e2);
+	}
+	hit.normal = glm::normalize(n);
+	hit.primitive = (int)best;
+	hit.barycentric = dvec2(bestB1, bestB2);
+}
+
+/**
+ * @fn	void IMesh::getHitTexCoords(const HitRecord &hit, const dvec3 &pt, double &u, double &v) const
+ * @brief	Interpolates the texture coordinates of the triangle recorded in the hit. Points
+ * 			off the triangle, such as the ends of a ray's footprint, are projected onto
+ * 			its plane and extrapolated.
+ * @param 		  	hit	A hit on this mesh.
+ * @param 		  	pt 	The point.
+ * @param [in,out]	u  	The u, in (u, v).
+ * @param [in,out]	v  	The v, in (u, v).
+ */
+
+void IMesh::getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const {
+	if (texCoords.empty() || hit.primitive < 0 || (size_t)hit.primitive >= triangles.size()) {
+		IShape::getTexCoords(pt, u, v);
+		return;
+	}
+	// Start from the weights at the hit and add those of the step from the hit to pt.
+	const MeshTriangle& tri = triangles[hit.primitive];
+	dvec3 d = pt - hit.interceptPt;
+	double d11 = glm::dot(tri.e1, tri.e1);
+	double d12 = glm::dot(tri.e1, tri.e2);
+	double d22 = glm::dot(tri.e2, tri.e2);
+	double denom = d11 * d22 - d12 * d12;
+	double b1 = hit.barycentric.x, b2 = hit.barycentric.y;
+	if (denom != 0) {
+		double p1 = glm::dot(d, tri.e1), p2 = glm::dot(d, tri.e2);
+		b1 += (d22 * p1 - d12 * p2) / denom;
+		b2 += (d11 * p2 - d12 * p1) / denom;
+	}
+	const unsigned int* corners = &indices[3 * hit.primitive];
+	dvec2 uv = (1 - b1 - b2) * texCoords[corners[0]] + b1 * texCoords[corners[1]] + b2 * texCoords[corners[2]];
+	u = uv.x;
+	v = uv.y;
+}
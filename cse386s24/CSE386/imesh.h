@@ -0,0 +1,51 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include "bvh.h"
+#include "eshape.h"
+#include "ishape.h"
+#include "meshcache.h"
+
+/**
+ * @struct	MeshTriangle
+ * @brief	A triangle set up for ray intersection: one corner and the two edges leaving it.
+ */
+
+struct MeshTriangle {
+	dvec3 a;	//!< First corner.
+	dvec3 e1;	//!< Second corner - first corner.
+	dvec3 e2;	//!< Third corner - first corner.
+};
+
+/**
+ * @struct	IMesh
+ * @brief	Implicit representation of an indexed triangle mesh, such as one read from
+ * 			an OBJ file, as a single shape. The triangles are kept in a BVH, so a ray
+ * 			only tests the few whose bounds it passes through. Normals and texture
+ * 			coordinates are interpolated across each triangle.
+ */
+
+struct IMesh : public IShape {
+	IMesh(const IndexedEShapeData& mesh);
+	IMesh(const MeshCache& cache);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual void getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const;
+	virtual BoundingBox getBounds() const { return bvh.getBounds(); }
+	unsigned int getTriangleCount() const { return (unsigned int)triangles.size(); }
+	const BVH& getBVH() const { return bvh; }
+protected:
+	void setUp(const vector<dvec3>& positions);
+	vector<dvec3> normals;			//!< Vertex normals.
+	vector<dvec2> texCoords;		//!< Vertex (u, v), or empty.
+	vector<unsigned int> indices;	//!< Index triplets, in BVH order.
+	vector<MeshTriangle> triangles;	//!< The triangles, in BVH order.
+	BVH bvh;						//!< The BVH over the triangles.
+};
@@ -9,6 +9,15 @@
 
 #include "iscene.h"
 
+/**
+ * @fn	IScene::IScene()
+ * @brief	Constructs an empty scene with no camera.
+ */
+
+IScene::IScene()
+	: camera(nullptr), shapesVersion(0), lightsVersion(0), cameraVersion(0), settingsVersion(0) {
+}
+
 /**
  * @fn	void IScene::addOpaqueObject(const VisibleIShapePtr obj)
  * @brief	Adds an visible object to the scene
@@ -17,6 +26,7 @@
 
 void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 	opaqueObjs.push_back(obj);
+	shapesChanged();
 }
 
 /**
@@ -27,6 +37,7 @@ void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 
 void IScene::addTransparentObject(const TransparentIShapePtr obj) {
 	transparentObjs.push_back(obj);
+	shapesChanged();
 }
 
 /**
@@ -37,4 +48,27 @@ void IScene::addTransparentObject(const TransparentIShapePtr obj) {
 
 void IScene::addLight(const LightSourcePtr light) {
 	lights.push_back(light);
+	lightsChanged();
+}
+
+/**
+ * @fn	void IScene::setCamera(RaytracingCamera *camera)
+ * @brief	Sets the scene's camera. The scene does not take ownership of it.
+ * @param	camera	The camera.
+ */
+
+void IScene::setCamera(RaytracingCamera* camera) {
+	this->camera = camera;
+	cameraChanged();
+}
+
+/**
+ * @fn	unsigned long IScene::version() const
+ * @brief	Returns a number that changes whenever any of the scene's version counters
+ * 			does. Equal versions mean nothing that was tracked has changed.
+ * @return	The sum of the version counters.
+ */
+
+unsigned long IScene::version() const {
+	return shapesVersion + lightsVersion + cameraVersion + settingsVersion;
 }
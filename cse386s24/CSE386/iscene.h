@@ -20,6 +20,10 @@
  /**
   * @struct	IScene
   * @brief	Represents an scene of implicitly represented objects. Used mostly in ray tracing.
+  * 		Version counters record changes to the scene, so a renderer can tell whether
+  * 		its last image is still current. Adding objects and lights and setting the
+  * 		camera update them automatically; code that changes an object, light or
+  * 		render setting in place must call the matching ...Changed method.
   */
 
 struct IScene {
@@ -27,7 +31,18 @@ struct IScene {
 	vector<VisibleIShapePtr> opaqueObjs;			//!< All the visible objects in the scene
 	vector<TransparentIShapePtr> transparentObjs;	//!< All the transparent objects in the scene
 	RaytracingCamera* camera;						//!< The one camera in the scene
+	unsigned long shapesVersion;					//!< Incremented when the shapes change
+	unsigned long lightsVersion;					//!< Incremented when the lights change
+	unsigned long cameraVersion;					//!< Incremented when the camera changes
+	unsigned long settingsVersion;					//!< Incremented when render settings change
+	IScene();
 	void addOpaqueObject(const VisibleIShapePtr obj);
 	void addTransparentObject(const TransparentIShapePtr obj);
 	void addLight(const LightSourcePtr light);
+	void setCamera(RaytracingCamera* camera);
+	void shapesChanged() { shapesVersion++; }
+	void lightsChanged() { lightsVersion++; }
+	void cameraChanged() { cameraVersion++; }
+	void settingsChanged() { settingsVersion++; }
+	unsigned long version() const;
 };
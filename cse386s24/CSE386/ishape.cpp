@@ -32,6 +32,34 @@ void IShape::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	u = v = 0;
 }
 
+/**
+ * @fn	void IShape::getHitTexCoords(const HitRecord &hit, const dvec3 &pt, double &u, double &v) const
+ * @brief	Computes the tex coordinate of a point on or near the surface, given a hit on
+ * 			this shape close to it. Shapes whose coordinates depend on the part that was
+ * 			hit, such as a triangle of a mesh, read it from the hit. By default, the
+ * 			hit is ignored and getTexCoords is used.
+ * @param 		  	hit	A hit on this shape, in this shape's coordinates.
+ * @param 		  	pt 	The point, such as hit.interceptPt.
+ * @param [in,out]	u  	The u, in (u, v).
+ * @param [in,out]	v  	The v, in (u, v).
+ */
+
+void IShape::getHitTexCoords(const HitRecord&, const dvec3& pt, double& u, double& v) const {
+	getTexCoords(pt, u, v);
+}
+
+/**
+ * @fn	BoundingBox IShape::getBounds() const
+ * @brief	Gets an axis aligned box containing the shape. The default is unbounded,
+ * 			which is right for shapes such as planes and suits any shape that has
+ * 			not said otherwise.
+ * @return	The bounds.
+ */
+
+BoundingBox IShape::getBounds() const {
+	return BoundingBox::unbounded();
+}
+
 /**
  * @fn	dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n)
  * @brief	Compute point that is slightly off surface.
@@ -46,13 +74,15 @@ dvec3 IShape::movePointOffSurface(const dvec3& pt, const dvec3& n) {
 }
 
 /**
- * @fn	VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat)
+ * @fn	VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material &mat, TextureHandle image)
  * @brief	Represents an visible, implicit shape.
  * @param	shapePtr	Pointer to the implicit shape.
  * @param	mat			Material
+ * @param	image		Texture, from the TextureRegistry or an Image*. A registry
+ * 						texture that has not been read yet is read when first hit.
  */
 
-VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material& mat, Image* image)
+VisibleIShape::VisibleIShape(IShapePtr shapePtr, const Material& mat, TextureHandle image)
 	: material(mat), shape(shapePtr) {
 	texture = image;
 }
@@ -69,9 +99,10 @@ void VisibleIShape::findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit
 	shape->findClosestIntersection(ray, hit);
 	if (hit.t != FLT_MAX) {
 		hit.material = material;
-		hit.texture = texture;
+		hit.texture = texture.get();
 		if (hit.texture != nullptr) {
-			shape->getTexCoords(hit.interceptPt, hit.u, hit.v);
+			shape->getHitTexCoords(hit, hit.interceptPt, hit.u, hit.v);
+			getTexFootprint(ray, hit);
 		}
 	}
 	//hit.t = FLT_MAX;
@@ -80,6 +111,44 @@ void VisibleIShape::findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit
 	//hit.material = material;
 }
 
+/**
+ * @fn	void VisibleIShape::getTexFootprint(const Ray &ray, OpaqueHitRecord &hit) const
+ * @brief	Estimates how much of the texture the ray covers where it hits. The ray's
+ * 			footprint is laid on the surface: across the ray it is as wide as the
+ * 			ray's cone, and along the ray it is stretched by 1/cos of the angle of
+ * 			incidence. The ends of both axes are mapped to (u, v) and the differences
+ * 			stored in hit.dUV1 and hit.dUV2. Rays without a cone leave them zero.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit, with interceptPt, normal, u and v set.
+ */
+
+void VisibleIShape::getTexFootprint(const Ray& ray, OpaqueHitRecord& hit) const {
+	const double MIN_COS = 1.0 / 64;	// Limits the stretch at grazing angles.
+	hit.dUV1 = hit.dUV2 = dvec2(0, 0);
+	double halfWidth = ray.getFootprint(hit.t) / 2;
+	if (halfWidth <= 0) {
+		return;
+	}
+	dvec3 n = glm::normalize(hit.normal);
+	double cosTheta = glm::dot(ray.dir, n);
+	dvec3 along = ray.dir - cosTheta * n;
+	if (glm::length(along) < EPSILON) {
+		along = glm::cross(n, std::abs(n.x) < 0.9 ? X_AXIS : Y_AXIS);
+	}
+	along = glm::normalize(along);
+	dvec3 across = glm::cross(n, along);
+
+	double u1, v1, u2, v2;
+	double stretch = 1.0 / glm::max(std::abs(cosTheta), MIN_COS);
+	shape->getHitTexCoords(hit, hit.interceptPt + halfWidth * stretch * along, u1, v1);
+	shape->getHitTexCoords(hit, hit.interceptPt + halfWidth * across, u2, v2);
+	// Footprints are small, so a difference of more than half means (u, v) wrapped around.
+	double du1 = u1 - hit.u, dv1 = v1 - hit.v;
+	double du2 = u2 - hit.u, dv2 = v2 - hit.v;
+	hit.dUV1 = 2.0 * dvec2(du1 - std::round(du1), dv1 - std::round(dv1));
+	hit.dUV2 = 2.0 * dvec2(du2 - std::round(du2), dv2 - std::round(dv2));
+}
+
 /**
  * @fn	HitRecord VisibleIShape::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces)
  * @brief	Searches for the first intersection
@@ -233,6 +302,20 @@ void IDisk::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	v = 1.0 - v;
 }
 
+/**
+ * @fn	BoundingBox IDisk::getBounds() const
+ * @brief	Gets an axis aligned box containing the disk.
+ * @return	The bounds.
+ */
+
+BoundingBox IDisk::getBounds() const {
+	dvec3 unitN = glm::normalize(n);
+	dvec3 extent(std::sqrt(glm::max(0.0, 1 - unitN.x * unitN.x)),
+				std::sqrt(glm::max(0.0, 1 - unitN.y * unitN.y)),
+				std::sqrt(glm::max(0.0, 1 - unitN.z * unitN.z)));
+	return BoundingBox(center - radius * extent, center + radius * extent);
+}
+
 /**
  * @fn	ISphere::ISphere(const dvec3 & position, double radius)
  * @brief	Implicit representation of a 3D sphere.
@@ -685,6 +768,25 @@ void IQuadricSurface::findClosestIntersection(const Ray& ray, HitRecord& hit) co
 	}
 }
 
+/**
+ * @fn	BoundingBox IQuadricSurface::getBounds() const
+ * @brief	Gets an axis aligned box containing the surface. Only ellipsoids (spheres
+ * 			included) are closed; other quadrics are unbounded unless a subclass
+ * 			clips them.
+ * @return	The bounds.
+ */
+
+BoundingBox IQuadricSurface::getBounds() const {
+	const QuadricParameters& q = qParams;
+	bool isEllipsoid = q.A > 0 && q.B > 0 && q.C > 0 && q.J < 0 &&
+		q.D == 0 && q.E == 0 && q.F == 0 && q.G == 0 && q.H == 0 && q.I == 0;
+	if (!isEllipsoid) {
+		return IShape::getBounds();
+	}
+	dvec3 extent(std::sqrt(-q.J / q.A), std::sqrt(-q.J / q.B), std::sqrt(-q.J / q.C));
+	return BoundingBox(center - extent, center + extent);
+}
+
 /**
  * @fn	dvec3 IQuadricSurface::normal(const dvec3 &P) const
  * @brief	Normals the given p
@@ -759,7 +861,7 @@ IConeY::IConeY(const dvec3& pos, double rad, double H)
  */
 
 void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	static HitRecord hits[2];
+	HitRecord hits[2];
 	int numHits = IQuadricSurface::findIntersections(ray, hits);
 
 	double minY = center.y - height;
@@ -777,6 +879,16 @@ void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	}
 }
 
+/**
+ * @fn	BoundingBox IConeY::getBounds() const
+ * @brief	Gets an axis aligned box containing the cone.
+ * @return	The bounds.
+ */
+
+BoundingBox IConeY::getBounds() const {
+	return BoundingBox(center - dvec3(radius, height, radius), center + dvec3(radius, 0, radius));
+}
+
 /**
  * @fn	ICylinderY::ICylinderY(const dvec3 &pos, double rad, double len)
  * @brief	Default constructor
@@ -824,6 +936,17 @@ void ICylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	}
 }
 
+/**
+ * @fn	BoundingBox ICylinderY::getBounds() const
+ * @brief	Gets an axis aligned box containing the cylinder.
+ * @return	The bounds.
+ */
+
+BoundingBox ICylinderY::getBounds() const {
+	dvec3 extent(radius, length / 2, radius);
+	return BoundingBox(center - extent, center + extent);
+}
+
 /**
 * @fn	void ICylinderY::getTexCoords(const dvec3 &pt, double &u, double &v) const
 * @brief	Gets tex coordinates
@@ -872,6 +995,17 @@ void ICylinderZ::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	}
 }
 
+/**
+ * @fn	BoundingBox ICylinderZ::getBounds() const
+ * @brief	Gets an axis aligned box containing the cylinder.
+ * @return	The bounds.
+ */
+
+BoundingBox ICylinderZ::getBounds() const {
+	dvec3 extent(radius, radius, length / 2);
+	return BoundingBox(center - extent, center + extent);
+}
+
 /**
 * Closed Cylinder Y
  */
@@ -916,7 +1050,7 @@ IEllipsoid::IEllipsoid(const dvec3& position, const dvec3& sz)
 */
 
 ITriangle::ITriangle(const dvec3& A, const dvec3& B, const dvec3& C)
-	: IShape(), a(A), b(B), c(C) {
+	: IShape(), a(A), b(B), c(C), e1(B - A), e2(C - A), n(normalFrom3Points(A, B, C)) {
 }
 
 /**
@@ -927,14 +1061,46 @@ ITriangle::ITriangle(const dvec3& A, const dvec3& B, const dvec3& C)
 */
 
 void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
-	dvec3 n = normalFrom3Points(a, b, c);
-	IPlane plane(a, n);
-	plane.findClosestIntersection(ray, hit);
-	if (hit.t != FLT_MAX && !inside(hit.interceptPt)) {
+	double t, b1, b2;
+	if (findIntersection(ray, t, b1, b2)) {
+		hit.t = t;
+		hit.interceptPt = ray.origin + t * ray.dir;
+		hit.normal = n;
+		hit.primitive = 0;
+		hit.barycentric = dvec2(b1, b2);
+	} else {
 		hit.t = FLT_MAX;
 	}
 }
 
+/**
+* @fn bool ITriangle::findIntersection(const Ray &ray, double &t, double &b1, double &b2) const
+* @brief Intersects the ray with the triangle, using the edges computed at construction.
+* @param ray The ray.
+* @param [out] t The ray parameter of the hit.
+* @param [out] b1 Barycentric weight of b at the hit.
+* @param [out] b2 Barycentric weight of c at the hit; a's is 1 - b1 - b2.
+* @return true iff the ray hits the triangle in front of its origin.
+*/
+
+bool ITriangle::findIntersection(const Ray& ray, double& t, double& b1, double& b2) const {
+	return intersectTriangle(ray, a, e1, e2, FLT_MAX, t, b1, b2);
+}
+
+/**
+* @fn BoundingBox ITriangle::getBounds() const
+* @brief Gets an axis aligned box containing the triangle.
+* @return The bounds.
+*/
+
+BoundingBox ITriangle::getBounds() const {
+	BoundingBox box;
+	box.expand(a);
+	box.expand(b);
+	box.expand(c);
+	return box;
+}
+
 /**
 * @fn bool ITriangle::inside(const dvec3 &pt) const
 * @brief Insides the given point
@@ -944,20 +1110,20 @@ void ITriangle::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 bool ITriangle::inside(const dvec3& pt) const {
 	// Using barycentric coordinate algorithm
-	dvec3 n = glm::cross((b - a), (c - a));
+	dvec3 areaNormal = glm::cross((b - a), (c - a));
 	dvec3 n_a = glm::cross((c - b), (pt - b));
 	dvec3 n_b = glm::cross((a - c), (pt - c));
 	dvec3 n_c = glm::cross((b - a), (pt - a));
 
-	double denum = glm::pow(glm::length(n), 2);
+	double denum = glm::pow(glm::length(areaNormal), 2);
 
 	if (denum == 0) { // The area of triangle is 0, which means triangle does not exist.
 		return false;
 	}
 
-	double alpha = glm::dot(n, n_a) / denum;
-	double beta = glm::dot(n, n_b) / denum;
-	double gamma = glm::dot(n, n_c) / denum;
+	double alpha = glm::dot(areaNormal, n_a) / denum;
+	double beta = glm::dot(areaNormal, n_b) / denum;
+	double gamma = glm::dot(areaNormal, n_c) / denum;
 
 	if (alpha > 0 && beta > 0 && gamma > 0 &&
 		alpha < 1 && beta < 1 && gamma < 1) {
@@ -965,4 +1131,144 @@ bool ITriangle::inside(const dvec3& pt) const {
 	}
 
 	return false;
-}
\ No newline at end of file
+}
+
+/**
+ * @fn	TriangleBatch::TriangleBatch()
+ * @brief	Constructs a batch of degenerate triangles.
+ */
+
+TriangleBatch::TriangleBatch() {
+	for (int i = 0; i < TRIANGLE_BATCH_SIZE; i++) {
+		set(i, ORIGIN3D, ORIGIN3D, ORIGIN3D);
+	}
+}
+
+/**
+ * @fn	void TriangleBatch::set(int slot, const dvec3 &a, const dvec3 &b, const dvec3 &c)
+ * @brief	Stores a triangle in one of the slots.
+ * @param	slot	The slot, 0 to TRIANGLE_BATCH_SIZE - 1.
+ * @param	a   	First vertex.
+ * @param	b   	Second vertex.
+ * @param	c   	Third vertex.
+ */
+
+void TriangleBatch::set(int slot, const dvec3& a, const dvec3& b, const dvec3& c) {
+	ax[slot] = a.x;
+	ay[slot] = a.y;
+	az[slot] = a.z;
+	e1x[slot] = b.x - a.x;
+	e1y[slot] = b.y - a.y;
+	e1z[slot] = b.z - a.z;
+	e2x[slot] = c.x - a.x;
+	e2y[slot] = c.y - a.y;
+	e2z[slot] = c.z - a.z;
+}
+
+/**
+ * @fn	int TriangleBatch::findClosestIntersection(const Ray &ray, double &tMax, double &b1, double &b2) const
+ * @brief	Intersects the ray with every triangle of the batch (Moller-Trumbore, as in
+ * 			intersectTriangle), one slot per vector lane, and picks the nearest hit.
+ * @param 		  	ray 	The ray.
+ * @param [in,out]	tMax	Hits at tMax or beyond are ignored. Lowered to the hit's t.
+ * @param [out]	  	b1  	Barycentric weight of the hit triangle's second vertex.
+ * @param [out]	  	b2  	Barycentric weight of its third vertex.
+ * @return	The slot of the nearest triangle hit, or -1 if none is.
+ */
+
+int TriangleBatch::findClosestIntersection(const Ray& ray, double& tMax, double& b1, double& b2) const {
+	const double ox = ray.origin.x, oy = ray.origin.y, oz = ray.origin.z;
+	const double dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+	const double limit = tMax;
+	double ts[TRIANGLE_BATCH_SIZE], us[TRIANGLE_BATCH_SIZE], vs[TRIANGLE_BATCH_SIZE];
+	for (int i = 0; i < TRIANGLE_BATCH_SIZE; i++) {
+		double px = dy * e2z[i] - dz * e2y[i];
+		double py = dz * e2x[i] - dx * e2z[i];
+		double pz = dx * e2y[i] - dy * e2x[i];
+		double det = e1x[i] * px + e1y[i] * py + e1z[i] * pz;
+		double invDet = 1.0 / det;
+		double sx = ox - ax[i], sy = oy - ay[i], sz = oz - az[i];
+		double qx = sy * e1z[i] - sz * e1y[i];
+		double qy = sz * e1x[i] - sx * e1z[i];
+		double qz = sx * e1y[i] - sy * e1x[i];
+		double u = (sx * px + sy * py + sz * pz) * invDet;
+		double v = (dx * qx + dy * qy + dz * qz) * invDet;
+		double t = (e2x[i] * qx + e2y[i] * qy + e2z[i] * qz) * invDet;
+		bool hit = (det != 0) & (u >= 0) & (v >= 0) & (u + v <= 1) & (t > 0) & (t < limit);
+		ts[i] = hit ? t : DBL_MAX;
+		us[i] = u;
+		vs[i] = v;
+	}
+	int best = -1;
+	for (int i = 0; i < TRIANGLE_BATCH_SIZE; i++) {
+		if (ts[i] < tMax) {
+			tMax = ts[i];
+			best = i;
+		}
+	}
+	if (best >= 0) {
+		b1 = us[best];
+		b2 = vs[best];
+	}
+	return best;
+}
+
+/**
+ * @fn	ITriangleSet::ITriangleSet(const vector<ITriangle> &triangles)
+ * @brief	Constructs a set from separate triangles.
+ * @param	triangles	The triangles.
+ */
+
+ITriangleSet::ITriangleSet(const vector<ITriangle>& triangles)
+	: IShape(), count(0) {
+	for (const ITriangle& tri : triangles) {
+		add(tri.a, tri.b, tri.c);
+	}
+}
+
+/**
+ * @fn	void ITriangleSet::add(const dvec3 &A, const dvec3 &B, const dvec3 &C)
+ * @brief	Adds a triangle, given its vertices in counterclockwise order.
+ * @param	A	First vertex.
+ * @param	B	Second vertex.
+ * @param	C	Third vertex.
+ */
+
+void ITriangleSet::add(const dvec3& A, const dvec3& B, const dvec3& C) {
+	if (count % TRIANGLE_BATCH_SIZE == 0) {
+		batches.push_back(TriangleBatch());
+	}
+	batches.back().set((int)(count % TRIANGLE_BATCH_SIZE), A, B, C);
+	normals.push_back(normalFrom3Points(A, B, C));
+	bounds.expand(A);
+	bounds.expand(B);
+	bounds.expand(C);
+	count++;
+}
+
+/**
+ * @fn	void ITriangleSet::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Searches for the nearest intersection with any of the triangles.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit; hit.t is FLT_MAX if the ray misses.
+ */
+
+void ITriangleSet::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
+	double tMax = FLT_MAX, b1, b2;
+	size_t best = count;
+	for (size_t i = 0; i < batches.size(); i++) {
+		int slot = batches[i].findClosestIntersection(ray, tMax, b1, b2);
+		if (slot >= 0) {
+			best = i * TRIANGLE_BATCH_SIZE + slot;
+		}
+	}
+	if (best == count) {
+		hit.t = FLT_MAX;
+		return;
+	}
+	hit.t = tMax;
+	hit.interceptPt = ray.origin + tMax * ray.dir;
+	hit.normal = normals[best];
+	hit.primitive = (int)best;
+	hit.barycentric = dvec2(b1, b2);
+}
@@ -8,8 +8,10 @@
  ****************************************************/
 
 #pragma once
+#include <cfloat>
 #include <vector>
 #include "hitrecord.h"
+#include "textureregistry.h"
 
 struct IShape;
 typedef IShape* IShapePtr;
@@ -27,12 +29,55 @@ typedef TransparentIShape* TransparentIShapePtr;
 struct Ray {
 	dvec3 origin;		//!< starting point for this ray
 	dvec3 dir;			//!< direction for this ray, given it's origin
+	double coneWidth;	//!< width of the area the ray stands for, at its origin
+	double coneSpread;	//!< growth of that width per unit distance along the ray
 	Ray(const dvec3& rayOrigin, const dvec3& rayDirection) :
-		origin(rayOrigin), dir(glm::normalize(rayDirection)) {
+		origin(rayOrigin), dir(glm::normalize(rayDirection)), coneWidth(0), coneSpread(0) {
 	}
 	dvec3 getPoint(double t) const {
 		return origin + t * dir;
 	}
+	double getFootprint(double t) const {
+		return coneWidth + t * coneSpread;
+	}
+};
+
+/**
+ * @struct	BoundingBox
+ * @brief	An axis aligned bounding box. A default constructed box is empty; one
+ * 			reaching to +/-DBL_MAX, from unbounded(), stands for shapes without bounds.
+ */
+
+struct BoundingBox {
+	dvec3 minCorner;	//!< Minimum corner.
+	dvec3 maxCorner;	//!< Maximum corner.
+	BoundingBox() : minCorner(DBL_MAX), maxCorner(-DBL_MAX) {}
+	BoundingBox(const dvec3& minCorner, const dvec3& maxCorner)
+		: minCorner(minCorner), maxCorner(maxCorner) {
+	}
+	static BoundingBox unbounded() { return BoundingBox(dvec3(-DBL_MAX), dvec3(DBL_MAX)); }
+	bool isEmpty() const { return minCorner.x > maxCorner.x; }
+	bool isBounded() const {
+		return !isEmpty() &&
+			minCorner.x > -DBL_MAX && minCorner.y > -DBL_MAX && minCorner.z > -DBL_MAX &&
+			maxCorner.x < DBL_MAX && maxCorner.y < DBL_MAX && maxCorner.z < DBL_MAX;
+	}
+	dvec3 getCenter() const { return (minCorner + maxCorner) / 2.0; }
+	void expand(const dvec3& pt) {
+		minCorner = glm::min(minCorner, pt);
+		maxCorner = glm::max(maxCorner, pt);
+	}
+	void expand(const BoundingBox& box) {
+		minCorner = glm::min(minCorner, box.minCorner);
+		maxCorner = glm::max(maxCorner, box.maxCorner);
+	}
+	double getSurfaceArea() const {
+		if (isEmpty()) {
+			return 0.0;
+		}
+		dvec3 d = maxCorner - minCorner;
+		return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
 };
 
 /**
@@ -44,6 +89,8 @@ struct IShape {
 	IShape();
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const = 0;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual void getHitTexCoords(const HitRecord& hit, const dvec3& pt, double& u, double& v) const;
+	virtual BoundingBox getBounds() const;
 	static dvec3 movePointOffSurface(const dvec3& pt, const dvec3& n);
 };
 
@@ -55,11 +102,13 @@ struct IShape {
 struct VisibleIShape {
 	Material material;	//!< Material for this shape.
 	IShapePtr shape;	//!< Pointer to underlying implicit shape.
-	Image* texture;		//!< Texture associated with this shape, if any.
-	VisibleIShape(IShapePtr shapePtr, const Material& mat, Image* image = nullptr);
+	TextureHandle texture;	//!< Texture associated with this shape, if any.
+	VisibleIShape(IShapePtr shapePtr, const Material& mat, TextureHandle image = TextureHandle());
 	void findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit) const;
 	static void findIntersection(const Ray& ray, const vector<VisibleIShapePtr>& surfaces,
 		OpaqueHitRecord& opaqueHitRecord);
+protected:
+	void getTexFootprint(const Ray& ray, OpaqueHitRecord& hit) const;
 };
 
 /**
@@ -109,6 +158,7 @@ struct IDisk : public IShape {
 	IDisk(const dvec3& position, const dvec3& n, double rad);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	virtual BoundingBox getBounds() const;
 	dvec3 center;	//!< center point of disk
 	dvec3 n;		//!< normal vector of disk
 	double radius;
@@ -147,6 +197,7 @@ struct IQuadricSurface : public IShape {
 		const dvec3& position);
 	IQuadricSurface(const dvec3& position);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual BoundingBox getBounds() const;
 	int findIntersections(const Ray& ray, HitRecord hits[2]) const;
 	dvec3 normal(const dvec3& pt) const;
 	void computeAqBqCq(const Ray& ray, double& Aq, double& Bq, double& Cq) const;
@@ -195,6 +246,7 @@ struct ICone : public IQuadricSurface {
 struct IConeY : public ICone {
 	IConeY(const dvec3& position, double R, double H);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual BoundingBox getBounds() const;
 };
 
 /**
@@ -206,6 +258,7 @@ struct ICylinderY : public ICylinder {
 	ICylinderY();
 	ICylinderY(const dvec3& position, double R, double len);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual BoundingBox getBounds() const;
 	void getTexCoords(const dvec3& pt, double& u, double& v) const;
 };
 
@@ -213,6 +266,7 @@ struct ICylinderZ : public ICylinder {
 	ICylinderZ();
 	ICylinderZ(const dvec3& position, double R, double len);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual BoundingBox getBounds() const;
 };
 
 struct IClosedCylinderY : public ICylinderY {
@@ -238,7 +292,81 @@ struct ITriangle : public IShape {
 	dvec3 a;//!< first vertex.
 	dvec3 b;//!< second vertex.
 	dvec3 c;//!< third vertex.
+	dvec3 e1;//!< b - a.
+	dvec3 e2;//!< c - a.
+	dvec3 n;//!< unit normal.
 	ITriangle(const dvec3& A, const dvec3& B, const dvec3& C);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	bool findIntersection(const Ray& ray, double& t, double& b1, double& b2) const;
+	virtual BoundingBox getBounds() const;
 	bool inside(const dvec3& pt) const;
+};
+
+/**
+ * @fn	inline bool intersectTriangle(const Ray &ray, const dvec3 &a, const dvec3 &e1, const dvec3 &e2,
+ * 									double tMax, double &t, double &b1, double &b2)
+ * @brief	Moller-Trumbore ray/triangle intersection. Everything is computed up front and
+ * 			tested once at the end, so there are no early outs to mispredict.
+ * @param 	ray 	The ray.
+ * @param 	a   	First corner of the triangle.
+ * @param 	e1  	Second corner - first corner.
+ * @param 	e2  	Third corner - first corner.
+ * @param 	tMax	Hits at tMax or beyond are ignored.
+ * @param	t   	Set to the ray parameter of the hit.
+ * @param	b1  	Set to the barycentric weight of the second corner.
+ * @param	b2  	Set to the barycentric weight of the third corner.
+ * @return	True if the ray hits the triangle (edges included) with 0 < t < tMax.
+ */
+
+inline bool intersectTriangle(const Ray& ray, const dvec3& a, const dvec3& e1, const dvec3& e2,
+	double tMax, double& t, double& b1, double& b2) {
+	dvec3 p = glm::cross(ray.dir, e2);
+	double det = glm::dot(e1, p);
+	double invDet = 1.0 / det;
+	dvec3 s = ray.origin - a;
+	dvec3 q = glm::cross(s, e1);
+	b1 = glm::dot(s, p) * invDet;
+	b2 = glm::dot(ray.dir, q) * invDet;
+	t = glm::dot(e2, q) * invDet;
+	// A ray parallel to the triangle gets det == 0 and non-finite values, which fail these.
+	return (det != 0) & (b1 >= 0) & (b2 >= 0) & (b1 + b2 <= 1) & (t > 0) & (t < tMax);
+}
+
+const int TRIANGLE_BATCH_SIZE = 8;	//!< Triangles a TriangleBatch tests together.
+
+/**
+ * @struct	TriangleBatch
+ * @brief	TRIANGLE_BATCH_SIZE triangles stored component by component, so that one ray
+ * 			is tested against all of them in loops the compiler can vectorize. Unused
+ * 			slots hold degenerate triangles, which are never hit.
+ */
+
+struct TriangleBatch {
+	double ax[TRIANGLE_BATCH_SIZE], ay[TRIANGLE_BATCH_SIZE], az[TRIANGLE_BATCH_SIZE];	//!< First corners.
+	double e1x[TRIANGLE_BATCH_SIZE], e1y[TRIANGLE_BATCH_SIZE], e1z[TRIANGLE_BATCH_SIZE];	//!< Second - first corners.
+	double e2x[TRIANGLE_BATCH_SIZE], e2y[TRIANGLE_BATCH_SIZE], e2z[TRIANGLE_BATCH_SIZE];	//!< Third - first corners.
+	TriangleBatch();
+	void set(int slot, const dvec3& a, const dvec3& b, const dvec3& c);
+	int findClosestIntersection(const Ray& ray, double& tMax, double& b1, double& b2) const;
+};
+
+/**
+ * @struct	ITriangleSet
+ * @brief	Implicit representation of many loose triangles as one shape, tested
+ * 			TRIANGLE_BATCH_SIZE at a time. Suits scenes with a lot of separate triangles
+ * 			sharing a material; large connected meshes belong in an IMesh.
+ */
+
+struct ITriangleSet : public IShape {
+	ITriangleSet() : count(0) {}
+	ITriangleSet(const vector<ITriangle>& triangles);
+	void add(const dvec3& A, const dvec3& B, const dvec3& C);
+	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
+	virtual BoundingBox getBounds() const { return bounds; }
+	size_t size() const { return count; }
+protected:
+	vector<TriangleBatch> batches;	//!< The triangles.
+	vector<dvec3> normals;			//!< Unit normal of each triangle.
+	size_t count;					//!< Number of triangles.
+	BoundingBox bounds;				//!< Bounds of all the triangles.
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <fstream>
+#include "mappedfile.h"
+
+#if !defined(WINDOWS) && !defined(_WIN32)
+#define MAPPEDFILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @fn	MappedFile::MappedFile(const std::string &fileName)
+ * @brief	Opens a file and makes its contents available. Check isOpen afterwards.
+ * @param	fileName	Name of the file.
+ */
+
+MappedFile::MappedFile(const std::string& fileName)
+	: opened(false), mapped(false), contents(nullptr), length(0) {
+#ifdef MAPPEDFILE_MMAP
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address != MAP_FAILED) {
+			contents = static_cast<const char*>(address);
+			length = (size_t)info.st_size;
+			mapped = true;
+			opened = true;
+		}
+	}
+	close(fd);
+	if (opened) {
+		return;
+	}
+#endif
+	std::ifstream input(fileName.c_str(), std::ios::binary | std::ios::ate);
+	if (!input) {
+		return;
+	}
+	std::streamoff size = input.tellg();
+	input.seekg(0);
+	buffer.resize((size_t)size);
+	if (size > 0 && !input.read(buffer.data(), size)) {
+		return;
+	}
+	contents = buffer.data();
+	length = buffer.size();
+	opened = true;
+}
+
+/**
+ * @fn	MappedFile::~MappedFile()
+ * @brief	Destructor. Unmaps the file, if it was mapped.
+ */
+
+MappedFile::~MappedFile() {
+#ifdef MAPPEDFILE_MMAP
+	if (mapped) {
+		munmap(const_cast<char*>(contents), length);
+	}
+#endif
+}
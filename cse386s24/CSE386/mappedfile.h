@@ -0,0 +1,36 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * @class	MappedFile
+ * @brief	Read-only view of a whole file's contents. Where the platform supports it
+ * 			the file is memory mapped; otherwise it is read into memory in one call.
+ */
+
+class MappedFile {
+public:
+	MappedFile(const std::string& fileName);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool isOpen() const { return opened; }
+	const char* data() const { return contents; }
+	size_t size() const { return length; }
+protected:
+	bool opened;				//!< True if the file could be read.
+	bool mapped;				//!< True if contents is a memory mapping.
+	const char* contents;		//!< The file's bytes.
+	size_t length;				//!< Number of bytes in the file.
+	std::vector<char> buffer;	//!< Holds the bytes when the file is not mapped.
+};
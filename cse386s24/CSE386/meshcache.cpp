@@ -0,0 +1,273 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "bvh.h"
+#include "meshcache.h"
+#include "utilities.h"
+
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304;	//!< Reads differently on a machine of the other byte order.
+
+/**
+ * @fn	static std::uint64_t alignOffset(std::uint64_t offset)
+ * @brief	Rounds an offset up to the next block boundary.
+ */
+
+static std::uint64_t alignOffset(std::uint64_t offset) {
+	return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+}
+
+/**
+ * @fn	static bool blockFits(std::uint64_t offset, std::uint64_t bytes, std::uint64_t fileSize)
+ * @brief	Determines whether a block lies on a block boundary within the file.
+ */
+
+static bool blockFits(std::uint64_t offset, std::uint64_t bytes, std::uint64_t fileSize) {
+	return offset % MESH_CACHE_ALIGNMENT == 0 && offset >= sizeof(MeshCacheHeader) &&
+		offset <= fileSize && bytes <= fileSize - offset;
+}
+
+/**
+ * @fn	bool MeshCache::open(const std::string &cacheFileName, std::uint64_t sourceHash)
+ * @brief	Maps a cache file and checks that it is one this version wrote, on a machine
+ * 			with the same byte order, from the same source, and that its blocks lie
+ * 			within it. The indices are trusted to be less than the vertex count.
+ * @param	cacheFileName	Name of the cache file.
+ * @param	sourceHash   	Hash of the file the mesh should have been made from.
+ * @return	True if the cache can be used; otherwise the cache is closed.
+ */
+
+bool MeshCache::open(const std::string& cacheFileName, std::uint64_t sourceHash) {
+	header = nullptr;
+	file.reset(new MappedFile(cacheFileName));
+	if (!file->isOpen() || file->size() < sizeof(MeshCacheHeader)) {
+		file.reset();
+		return false;
+	}
+	const MeshCacheHeader* h = reinterpret_cast<const MeshCacheHeader*>(file->data());
+	const std::uint64_t size = file->size();
+	const std::uint64_t vertices = h->vertexCount;
+	bool valid = std::memcmp(h->magic, "MSH", 4) == 0 && h->version == MESH_CACHE_VERSION &&
+		h->byteOrder == BYTE_ORDER_MARK && h->sourceHash == sourceHash && h->fileSize == size &&
+		h->indexCount % 3 == 0 &&
+		blockFits(h->positionsOffset, vertices * sizeof(glm::vec3), size) &&
+		blockFits(h->normalsOffset, vertices * sizeof(glm::vec3), size) &&
+		blockFits(h->indicesOffset, (std::uint64_t)h->indexCount * sizeof(unsigned int), size) &&
+		(h->hasTexCoords == 0 ? h->texCoordsOffset == 0 :
+			blockFits(h->texCoordsOffset, vertices * sizeof(glm::vec2), size)) &&
+		(h->bvhNodeCount == 0 ? h->bvhOffset == 0 :
+			blockFits(h->bvhOffset, (std::uint64_t)h->bvhNodeCount * h->bvhNodeSize, size));
+	if (!valid) {
+		file.reset();
+		return false;
+	}
+	header = h;
+	return true;
+}
+
+/**
+ * @fn	bool MeshCache::openObj(const std::string &objFileName)
+ * @brief	Opens the cache of an OBJ file, objFileName + MESH_CACHE_EXTENSION. If there is
+ * 			no cache, or it was made from a different version of the OBJ file, the OBJ
+ * 			file is read and the cache written first, with the BVH IMesh uses.
+ * @param	objFileName	The OBJ file.
+ * @return	True if the cache is open. Problems are reported on cout.
+ */
+
+bool MeshCache::openObj(const std::string& objFileName) {
+	std::uint64_t sourceHash;
+	{
+		MappedFile obj(objFileName);
+		if (!obj.isOpen()) {
+			cout << "Error: Cannot open file " << objFileName << endl;
+			return false;
+		}
+		sourceHash = hashBytes(obj.data(), obj.size());
+	}
+	const std::string cacheFileName = objFileName + MESH_CACHE_EXTENSION;
+	if (open(cacheFileName, sourceHash)) {
+		return true;
+	}
+	IndexedEShapeData mesh = EShape::createIndexedEObj(objFileName);
+	if (mesh.indices.empty()) {
+		return false;
+	}
+	vector<dvec3> positions(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		positions[i] = mesh.vertices[i].pos.xyz();
+	}
+	BVH bvh = BVH::forTriangles(positions, mesh.indices);
+	if (!write(cacheFileName, mesh, sourceHash, bvh.getNodes(), bvh.getNodeCount(), sizeof(BVHNode)) ||
+		!open(cacheFileName, sourceHash)) {
+		cout << "Error: Cannot write mesh cache " << cacheFileName << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	MeshBounds MeshCache::getBounds() const
+ * @brief	Gets the bounds stored with the mesh.
+ * @return	The bounds, in object coordinates.
+ */
+
+MeshBounds MeshCache::getBounds() const {
+	MeshBounds bounds;
+	bounds.minCorner = dvec3(header->minCorner[0], header->minCorner[1], header->minCorner[2]);
+	bounds.maxCorner = dvec3(header->maxCorner[0], header->maxCorner[1], header->maxCorner[2]);
+	bounds.center = dvec3(header->center[0], header->center[1], header->center[2]);
+	bounds.radius = header->radius;
+	return bounds;
+}
+
+/**
+ * @fn	IndexedEShapeData MeshCache::toIndexedEShape(const Material &mat) const
+ * @brief	Copies the mesh into an IndexedEShapeData, for the pipeline, and builds its
+ * 			meshlets.
+ * @param	mat	Material for every vertex.
+ * @return	The mesh.
+ */
+
+IndexedEShapeData MeshCache::toIndexedEShape(const Material& mat) const {
+	IndexedEShapeData mesh;
+	const glm::vec3* positions = getPositions();
+	const glm::vec3* normals = getNormals();
+	mesh.vertices.reserve(getVertexCount());
+	for (unsigned int i = 0; i < getVertexCount(); i++) {
+		mesh.vertices.push_back(VertexData(dvec4(dvec3(positions[i]), 1.0), dvec3(normals[i]), mat));
+	}
+	if (header->hasTexCoords) {
+		const glm::vec2* texCoords = getTexCoords();
+		mesh.texCoords.reserve(getVertexCount());
+		for (unsigned int i = 0; i < getVertexCount(); i++) {
+			mesh.texCoords.push_back(dvec2(texCoords[i]));
+		}
+	}
+	mesh.indices.assign(getIndices(), getIndices() + getIndexCount());
+	mesh.bounds = getBounds();
+	EShape::buildMeshlets(mesh);
+	return mesh;
+}
+
+/**
+ * @fn	static void writeBlock(std::ofstream &out, std::uint64_t offset, const void *data, size_t bytes)
+ * @brief	Pads the file with zeros up to offset and writes a block there.
+ */
+
+static void writeBlock(std::ofstream& out, std::uint64_t offset, const void* data, size_t bytes) {
+	static const char ZEROS[MESH_CACHE_ALIGNMENT] = {};
+	std::uint64_t at = (std::uint64_t)out.tellp();
+	if (at < offset) {
+		out.write(ZEROS, (std::streamsize)(offset - at));
+	}
+	out.write(static_cast<const char*>(data), (std::streamsize)bytes);
+}
+
+/**
+ * @fn	bool MeshCache::write(const std::string &cacheFileName, const IndexedEShapeData &mesh,
+ * 							std::uint64_t sourceHash, const void *bvhNodes,
+ * 							unsigned int bvhNodeCount, unsigned int bvhNodeSize)
+ * @brief	Writes a mesh to a cache file. Positions, normals and texture coordinates are
+ * 			stored as floats; materials are not stored.
+ * @param	cacheFileName	Name of the cache file.
+ * @param	mesh		 	The mesh.
+ * @param	sourceHash   	Hash of the file the mesh was made from, or 0.
+ * @param	bvhNodes	 	BVH nodes to store with the mesh, or nullptr.
+ * @param	bvhNodeCount 	Number of BVH nodes.
+ * @param	bvhNodeSize  	Size of a BVH node, in bytes.
+ * @return	True if the file was written. If not, no file is left behind.
+ */
+
+bool MeshCache::write(const std::string& cacheFileName, const IndexedEShapeData& mesh,
+	std::uint64_t sourceHash, const void* bvhNodes,
+	unsigned int bvhNodeCount, unsigned int bvhNodeSize) {
+	const size_t vertexCount = mesh.vertices.size();
+	const bool hasTexCoords = mesh.texCoords.size() == vertexCount && vertexCount > 0;
+	vector<glm::vec3> positions(vertexCount), normals(vertexCount);
+	vector<glm::vec2> texCoords(hasTexCoords ? vertexCount : 0);
+	for (size_t i = 0; i < vertexCount; i++) {
+		positions[i] = glm::vec3(mesh.vertices[i].pos.xyz());
+		normals[i] = glm::vec3(mesh.vertices[i].normal);
+		if (hasTexCoords) {
+			texCoords[i] = glm::vec2(mesh.texCoords[i]);
+		}
+	}
+	MeshBounds bounds = mesh.bounds.isKnown() ? mesh.bounds :
+		EShape::computeBounds(mesh);
+
+	MeshCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, "MSH", 4);
+	header.version = MESH_CACHE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.hasTexCoords = hasTexCoords ? 1 : 0;
+	header.sourceHash = sourceHash;
+	header.vertexCount = (std::uint32_t)vertexCount;
+	header.indexCount = (std::uint32_t)mesh.indices.size();
+	header.bvhNodeCount = bvhNodes != nullptr ? bvhNodeCount : 0;
+	header.bvhNodeSize = bvhNodeSize;
+	for (int i = 0; i < 3; i++) {
+		header.minCorner[i] = bounds.minCorner[i];
+		header.maxCorner[i] = bounds.maxCorner[i];
+		header.center[i] = bounds.center[i];
+	}
+	header.radius = bounds.radius;
+	std::uint64_t offset = alignOffset(sizeof(header));
+	header.positionsOffset = offset;
+	offset = alignOffset(offset + vertexCount * sizeof(glm::vec3));
+	header.normalsOffset = offset;
+	offset = alignOffset(offset + vertexCount * sizeof(glm::vec3));
+	if (hasTexCoords) {
+		header.texCoordsOffset = offset;
+		offset = alignOffset(offset + vertexCount * sizeof(glm::vec2));
+	}
+	header.indicesOffset = offset;
+	offset += mesh.indices.size() * sizeof(unsigned int);
+	if (header.bvhNodeCount > 0) {
+		offset = alignOffset(offset);
+		header.bvhOffset = offset;
+		offset += (std::uint64_t)header.bvhNodeCount * bvhNodeSize;
+	}
+	header.fileSize = offset;
+
+	std::ofstream out(cacheFileName.c_str(), std::ios::binary);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	writeBlock(out, header.positionsOffset, positions.data(), positions.size() * sizeof(glm::vec3));
+	writeBlock(out, header.normalsOffset, normals.data(), normals.size() * sizeof(glm::vec3));
+	if (hasTexCoords) {
+		writeBlock(out, header.texCoordsOffset, texCoords.data(), texCoords.size() * sizeof(glm::vec2));
+	}
+	writeBlock(out, header.indicesOffset, mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+	if (header.bvhNodeCount > 0) {
+		writeBlock(out, header.bvhOffset, bvhNodes, (size_t)header.bvhNodeCount * bvhNodeSize);
+	}
+	out.close();
+	if (!out) {
+		std::remove(cacheFileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	bool MeshCache::write(const std::string &cacheFileName, const EShapeData &shape, std::uint64_t sourceHash)
+ * @brief	Writes the output of one of the EShape generators, or of EShape::createEObj, to a
+ * 			cache file, merging the vertices the triangles share (see EShape::createIndexedEShape).
+ * @param	cacheFileName	Name of the cache file.
+ * @param	shape		 	The triangles.
+ * @param	sourceHash   	Hash of the file the triangles were made from, or 0.
+ * @return	True if the file was written.
+ */
+
+bool MeshCache::write(const std::string& cacheFileName, const EShapeData& shape,
+	std::uint64_t sourceHash) {
+	return write(cacheFileName, EShape::createIndexedEShape(shape), sourceHash);
+}
@@ -0,0 +1,89 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "eshape.h"
+#include "mappedfile.h"
+
+const char MESH_CACHE_EXTENSION[] = ".meshcache";	//!< Appended to an OBJ's name to name its cache.
+const std::uint32_t MESH_CACHE_VERSION = 2;			//!< Changes whenever the layout does.
+const std::uint64_t MESH_CACHE_ALIGNMENT = 64;		//!< Blocks start on multiples of this many bytes.
+
+/**
+ * @struct	MeshCacheHeader
+ * @brief	Start of a mesh cache file. The blocks it points to follow it, each starting
+ * 			on a MESH_CACHE_ALIGNMENT byte boundary, in native byte order:
+ * 			vertexCount positions and normals (3 floats each), vertexCount texture
+ * 			coordinates (2 floats each) if hasTexCoords, indexCount indices (32 bit),
+ * 			and bvhNodeCount BVH nodes of bvhNodeSize bytes each.
+ */
+
+struct MeshCacheHeader {
+	char magic[4];					//!< "MSH" and a 0.
+	std::uint32_t version;			//!< MESH_CACHE_VERSION.
+	std::uint32_t byteOrder;		//!< 0x01020304, as written by the machine that made the file.
+	std::uint32_t hasTexCoords;		//!< 1 if there is a texture coordinate block.
+	std::uint64_t sourceHash;		//!< Hash of the file the mesh was made from, or 0.
+	std::uint64_t fileSize;			//!< Size of the whole cache file.
+	std::uint32_t vertexCount;		//!< Number of vertices.
+	std::uint32_t indexCount;		//!< Number of indices, 3 per triangle.
+	std::uint32_t bvhNodeCount;		//!< Number of BVH nodes; 0 if there is no BVH.
+	std::uint32_t bvhNodeSize;		//!< Size of a BVH node, in bytes.
+	double minCorner[3];			//!< Minimum corner of the bounding box.
+	double maxCorner[3];			//!< Maximum corner of the bounding box.
+	double center[3];				//!< Center of the bounding sphere.
+	double radius;					//!< Radius of the bounding sphere; negative if unknown.
+	std::uint64_t positionsOffset;	//!< Where the positions start.
+	std::uint64_t normalsOffset;	//!< Where the normals start.
+	std::uint64_t texCoordsOffset;	//!< Where the texture coordinates start, or 0.
+	std::uint64_t indicesOffset;	//!< Where the indices start.
+	std::uint64_t bvhOffset;		//!< Where the BVH nodes start, or 0.
+};
+
+/**
+ * @class	MeshCache
+ * @brief	A mesh stored in a binary cache file. Opening one maps the file and checks
+ * 			its header; the vertex, index and BVH blocks are then used in place, with
+ * 			no parsing and no copying.
+ */
+
+class MeshCache {
+public:
+	MeshCache() : header(nullptr) {}
+	bool open(const std::string& cacheFileName, std::uint64_t sourceHash);
+	bool openObj(const std::string& objFileName);
+	bool isOpen() const { return header != nullptr; }
+	unsigned int getVertexCount() const { return header->vertexCount; }
+	unsigned int getIndexCount() const { return header->indexCount; }
+	const glm::vec3* getPositions() const { return block<glm::vec3>(header->positionsOffset); }
+	const glm::vec3* getNormals() const { return block<glm::vec3>(header->normalsOffset); }
+	const glm::vec2* getTexCoords() const { return block<glm::vec2>(header->texCoordsOffset); }
+	const unsigned int* getIndices() const { return block<unsigned int>(header->indicesOffset); }
+	unsigned int getBVHNodeCount() const { return header->bvhNodeCount; }
+	unsigned int getBVHNodeSize() const { return header->bvhNodeSize; }
+	const void* getBVHNodes() const { return block<char>(header->bvhOffset); }
+	MeshBounds getBounds() const;
+	IndexedEShapeData toIndexedEShape(const Material& mat) const;
+	static bool write(const std::string& cacheFileName, const IndexedEShapeData& mesh,
+		std::uint64_t sourceHash, const void* bvhNodes = nullptr,
+		unsigned int bvhNodeCount = 0, unsigned int bvhNodeSize = 0);
+	static bool write(const std::string& cacheFileName, const EShapeData& shape,
+		std::uint64_t sourceHash);
+protected:
+	template <class T>
+	const T* block(std::uint64_t offset) const {
+		return offset == 0 ? nullptr : reinterpret_cast<const T*>(file->data() + offset);
+	}
+	std::unique_ptr<MappedFile> file;	//!< The cache file.
+	const MeshCacheHeader* header;		//!< Start of the file, or nullptr if not open.
+};
@@ -0,0 +1,513 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include "objloader.h"
+#include "mappedfile.h"
+
+const int NO_INDEX = INT_MIN;	//!< Index of an attribute a corner does not have.
+
+/**
+ * @struct	ObjCorner
+ * @brief	One corner of a triangle, as the 0 based indices of its position, texture
+ * 			coordinate and normal, or NO_INDEX. While a piece of the file is parsed,
+ * 			relative indices are counted from the start of the piece and flagged,
+ * 			since the piece does not yet know how much of the file comes before it.
+ */
+
+struct ObjCorner {
+	int index[3];			//!< Position, texture coordinate and normal.
+	unsigned char local;	//!< Bit i is set if index[i] is counted from the start of the piece.
+};
+
+/**
+ * @struct	ObjPiece
+ * @brief	What one thread parsed from its piece of the file.
+ */
+
+struct ObjPiece {
+	const char* begin;			//!< First byte of the piece.
+	const char* end;			//!< One past the last byte.
+	vector<dvec3> positions;	//!< v statements.
+	vector<dvec2> texCoords;	//!< vt statements.
+	vector<dvec3> normals;		//!< vn statements.
+	vector<ObjCorner> corners;	//!< Three per triangle.
+	const char* error;			//!< Where parsing failed, or nullptr.
+	const char* message;		//!< Why parsing failed.
+};
+
+/**
+ * @fn	static inline bool isBlank(char c)
+ * @brief	Determines whether c separates the fields of a line.
+ */
+
+static inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @fn	static inline bool isDigit(char c)
+ * @brief	Determines whether c is a decimal digit.
+ */
+
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * @fn	static inline void skipBlanks(const char *&p, const char *end)
+ * @brief	Advances p past blanks.
+ */
+
+static inline void skipBlanks(const char*& p, const char* end) {
+	while (p < end && isBlank(*p)) {
+		p++;
+	}
+}
+
+/**
+ * @fn	static double powerOfTen(int exponent)
+ * @brief	Computes 10^exponent. Powers up to 10^22 are exact doubles and come from a table.
+ */
+
+static double powerOfTen(int exponent) {
+	static const double POWERS[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	return exponent <= 22 ? POWERS[exponent] : std::pow(10.0, exponent);
+}
+
+/**
+ * @fn	static bool parseDouble(const char *&p, const char *end, double &value)
+ * @brief	Parses a decimal number, such as -1.25e-3, after any blanks. Up to 19
+ * 			significant digits are used, which is more than a double holds.
+ * @param [in,out]	p	 	Where to start; on success, just past the number.
+ * @param 		  	end	 	End of the line.
+ * @param [out]   	value	The number.
+ * @return	True if there was a number.
+ */
+
+static bool parseDouble(const char*& p, const char* end, double& value) {
+	skipBlanks(p, end);
+	const char* q = p;
+	bool negative = false;
+	if (q < end && (*q == '-' || *q == '+')) {
+		negative = *q == '-';
+		q++;
+	}
+	std::uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+	for (; q < end && isDigit(*q); q++) {
+		anyDigits = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*q - '0');
+			digits += mantissa != 0;
+		} else {
+			exponent++;
+		}
+	}
+	if (q < end && *q == '.') {
+		for (q++; q < end && isDigit(*q); q++) {
+			anyDigits = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*q - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!anyDigits) {
+		return false;
+	}
+	if (q < end && (*q == 'e' || *q == 'E')) {
+		const char* e = q + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+')) {
+			negativeExponent = *e == '-';
+			e++;
+		}
+		if (e < end && isDigit(*e)) {
+			int written = 0;
+			for (; e < end && isDigit(*e); e++) {
+				written = std::min(written * 10 + (*e - '0'), 100000);
+			}
+			exponent += negativeExponent ? -written : written;
+			q = e;
+		}
+	}
+	value = (double)mantissa;
+	if (exponent < 0) {
+		value /= powerOfTen(-exponent);
+	} else if (exponent > 0) {
+		value *= powerOfTen(exponent);
+	}
+	if (negative) {
+		value = -value;
+	}
+	p = q;
+	return true;
+}
+
+/**
+ * @fn	static bool parseInt(const char *&p, const char *end, int &value)
+ * @brief	Parses a possibly negative integer, with no leading blanks.
+ * @param [in,out]	p	 	Where to start; on success, just past the integer.
+ * @param 		  	end	 	End of the line.
+ * @param [out]   	value	The integer.
+ * @return	True if there was an integer that fits in an int.
+ */
+
+static bool parseInt(const char*& p, const char* end, int& value) {
+	const char* q = p;
+	bool negative = q < end && *q == '-';
+	if (negative || (q < end && *q == '+')) {
+		q++;
+	}
+	if (q >= end || !isDigit(*q)) {
+		return false;
+	}
+	long long n = 0;
+	for (; q < end && isDigit(*q); q++) {
+		n = n * 10 + (*q - '0');
+		if (n > INT_MAX) {
+			return false;
+		}
+	}
+	value = (int)(negative ? -n : n);
+	p = q;
+	return true;
+}
+
+/**
+ * @fn	static bool setIndex(ObjCorner &corner, int which, int objIndex, size_t count)
+ * @brief	Converts an OBJ index, which counts from 1, or back from -1 for the most
+ * 			recent element, to a 0 based index.
+ * @param [in,out]	corner  	The corner.
+ * @param 		  	which   	0 for the position, 1 for the texture coordinate, 2 for the normal.
+ * @param 		  	objIndex	The index as written.
+ * @param 		  	count   	Number of such elements so far in the piece.
+ * @return	False if the index is 0, which OBJ does not allow.
+ */
+
+static bool setIndex(ObjCorner& corner, int which, int objIndex, size_t count) {
+	if (objIndex > 0) {
+		corner.index[which] = objIndex - 1;
+	} else if (objIndex < 0) {
+		corner.index[which] = (int)count + objIndex;
+		corner.local |= 1 << which;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	static bool parseFace(ObjPiece &piece, const char *p, const char *end, vector<ObjCorner> &face)
+ * @brief	Parses the corners of an f statement, each v, v/vt, v//vn or v/vt/vn, and adds
+ * 			the face to the piece as a fan of triangles around its first corner.
+ * @param [in,out]	piece	The piece.
+ * @param 		  	p	 	Just after the "f".
+ * @param 		  	end	 	End of the line.
+ * @param [in,out]	face 	Scratch space for the corners.
+ * @return	True if the face was valid.
+ */
+
+static bool parseFace(ObjPiece& piece, const char* p, const char* end, vector<ObjCorner>& face) {
+	face.clear();
+	while (true) {
+		skipBlanks(p, end);
+		if (p >= end) {
+			break;
+		}
+		ObjCorner corner = { { NO_INDEX, NO_INDEX, NO_INDEX }, 0 };
+		int value;
+		if (!parseInt(p, end, value) || !setIndex(corner, 0, value, piece.positions.size())) {
+			return false;
+		}
+		if (p < end && *p == '/') {
+			p++;
+			if (p < end && *p != '/') {
+				if (!parseInt(p, end, value) || !setIndex(corner, 1, value, piece.texCoords.size())) {
+					return false;
+				}
+			}
+			if (p < end && *p == '/') {
+				p++;
+				if (!parseInt(p, end, value) || !setIndex(corner, 2, value, piece.normals.size())) {
+					return false;
+				}
+			}
+		}
+		if (p < end && !isBlank(*p)) {
+			return false;
+		}
+		face.push_back(corner);
+	}
+	if (face.size() < 3) {
+		return false;
+	}
+	for (size_t i = 1; i + 1 < face.size(); i++) {
+		piece.corners.push_back(face[0]);
+		piece.corners.push_back(face[i]);
+		piece.corners.push_back(face[i + 1]);
+	}
+	return true;
+}
+
+/**
+ * @fn	static void parsePiece(ObjPiece &piece)
+ * @brief	Parses the statements in one piece of the file. Stops at the first error,
+ * 			recording where it was.
+ * @param [in,out]	piece	The piece.
+ */
+
+static void parsePiece(ObjPiece& piece) {
+	vector<ObjCorner> face;
+	const char* p = piece.begin;
+	while (p < piece.end) {
+		const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', piece.end - p));
+		if (lineEnd == nullptr) {
+			lineEnd = piece.end;
+		}
+		skipBlanks(p, lineEnd);
+		bool ok = true;
+		if (lineEnd - p >= 2 && p[0] == 'v' && isBlank(p[1])) {
+			dvec3 V;
+			p++;
+			ok = parseDouble(p, lineEnd, V.x) && parseDouble(p, lineEnd, V.y) &&
+				parseDouble(p, lineEnd, V.z);
+			piece.positions.push_back(V);
+			piece.message = "bad vertex";
+		} else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+			dvec2 T(0, 0);
+			p += 2;
+			ok = parseDouble(p, lineEnd, T.x);
+			parseDouble(p, lineEnd, T.y);
+			piece.texCoords.push_back(T);
+			piece.message = "bad texture coordinate";
+		} else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank(p[2])) {
+			dvec3 N;
+			p += 2;
+			ok = parseDouble(p, lineEnd, N.x) && parseDouble(p, lineEnd, N.y) &&
+				parseDouble(p, lineEnd, N.z);
+			piece.normals.push_back(N);
+			piece.message = "bad normal";
+		} else if (lineEnd - p >= 2 && p[0] == 'f' && isBlank(p[1])) {
+			ok = parseFace(piece, p + 1, lineEnd, face);
+			piece.message = "bad face";
+		}
+		if (!ok) {
+			piece.error = p;
+			return;
+		}
+		p = lineEnd + 1;
+	}
+}
+
+/**
+ * @fn	static bool resolvePiece(ObjPiece &piece, const size_t base[3], const size_t total[3])
+ * @brief	Makes the piece's relative indices absolute and checks every index.
+ * @param [in,out]	piece	The piece.
+ * @param 		  	base 	Number of positions, texture coordinates and normals before the piece.
+ * @param 		  	total	Number of each in the whole file.
+ * @return	True if every index refers to an element in the file.
+ */
+
+static bool resolvePiece(ObjPiece& piece, const size_t base[3], const size_t total[3]) {
+	for (ObjCorner& corner : piece.corners) {
+		for (int i = 0; i < 3; i++) {
+			if (corner.index[i] == NO_INDEX) {
+				continue;
+			}
+			long long index = corner.index[i];
+			if (corner.local & (1 << i)) {
+				index += (long long)base[i];
+			}
+			if (index < 0 || index >= (long long)total[i]) {
+				return false;
+			}
+			corner.index[i] = (int)index;
+		}
+		corner.local = 0;
+	}
+	return true;
+}
+
+/**
+ * @fn	bool ObjLoader::load(const std::string &filename, const Material &mat, IndexedEShapeData &mesh)
+ * @brief	Reads an OBJ file into an indexed mesh. Corners with the same position,
+ * 			texture coordinate and normal share a vertex. Vertices without a normal get
+ * 			the average of the normals of the faces around them. If any face has
+ * 			texture coordinates, mesh.texCoords gets one per vertex. Bounds and
+ * 			meshlets are left for the caller. Problems are reported on cout.
+ * @param 		  	filename	The OBJ file.
+ * @param 		  	mat			Material for every vertex.
+ * @param [in,out]	mesh		The mesh. Its previous contents are replaced.
+ * @return	True if the file was read; otherwise the mesh is empty.
+ */
+
+bool ObjLoader::load(const std::string& filename, const Material& mat, IndexedEShapeData& mesh) {
+	mesh = IndexedEShapeData();
+	MappedFile file(filename);
+	if (!file.isOpen()) {
+		cout << "Error: Cannot open file " << filename << endl;
+		return false;
+	}
+
+	// Split the file at line boundaries, one piece per thread.
+	const char* data = file.data();
+	const char* fileEnd = data + file.size();
+	size_t numPieces = std::max(1u, std::thread::hardware_concurrency());
+	numPieces = std::max((size_t)1, std::min(numPieces, file.size() / MIN_OBJ_BYTES_PER_THREAD));
+	vector<ObjPiece> pieces(numPieces);
+	const char* begin = data;
+	for (size_t i = 0; i < numPieces; i++) {
+		const char* end = i + 1 == numPieces ? fileEnd : data + file.size() * (i + 1) / numPieces;
+		if (end < begin) {
+			end = begin;
+		}
+		const char* newline = static_cast<const char*>(std::memchr(end, '\n', fileEnd - end));
+		end = newline != nullptr ? newline + 1 : fileEnd;
+		pieces[i].begin = begin;
+		pieces[i].end = end;
+		pieces[i].error = nullptr;
+		pieces[i].message = "";
+		begin = end;
+	}
+
+	vector<std::thread> workers;
+	for (size_t i = 1; i < numPieces; i++) {
+		workers.push_back(std::thread(parsePiece, std::ref(pieces[i])));
+	}
+	parsePiece(pieces[0]);
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	for (const ObjPiece& piece : pieces) {
+		if (piece.error != nullptr) {
+			long long line = 1 + std::count(data, piece.error, '\n');
+			cout << "Error: " << piece.message << " in " << filename << ", line " << line << endl;
+			return false;
+		}
+	}
+
+	// Make relative indices absolute, now that each piece knows what comes before it.
+	vector<size_t> bases(3 * numPieces);
+	size_t total[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < numPieces; i++) {
+		bases[3 * i] = total[0];
+		bases[3 * i + 1] = total[1];
+		bases[3 * i + 2] = total[2];
+		total[0] += pieces[i].positions.size();
+		total[1] += pieces[i].texCoords.size();
+		total[2] += pieces[i].normals.size();
+	}
+	vector<char> resolved(numPieces, 1);
+	workers.clear();
+	for (size_t i = 1; i < numPieces; i++) {
+		workers.push_back(std::thread([&, i]() { resolved[i] = resolvePiece(pieces[i], &bases[3 * i], total); }));
+	}
+	resolved[0] = resolvePiece(pieces[0], &bases[0], total);
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	if (std::count(resolved.begin(), resolved.end(), 0) > 0) {
+		cout << "Error: face refers to a missing vertex in " << filename << endl;
+		return false;
+	}
+
+	vector<dvec3> positions, normals;
+	vector<dvec2> texCoords;
+	positions.reserve(total[0]);
+	texCoords.reserve(total[1]);
+	normals.reserve(total[2]);
+	size_t numCorners = 0;
+	bool hasTexCoords = false;
+	for (ObjPiece& piece : pieces) {
+		positions.insert(positions.end(), piece.positions.begin(), piece.positions.end());
+		texCoords.insert(texCoords.end(), piece.texCoords.begin(), piece.texCoords.end());
+		normals.insert(normals.end(), piece.normals.begin(), piece.normals.end());
+		vector<dvec3>().swap(piece.positions);
+		vector<dvec2>().swap(piece.texCoords);
+		vector<dvec3>().swap(piece.normals);
+		numCorners += piece.corners.size();
+		for (const ObjCorner& corner : piece.corners) {
+			if (corner.index[1] != NO_INDEX) {
+				hasTexCoords = true;
+				break;
+			}
+		}
+	}
+	for (dvec3& N : normals) {
+		if (glm::length(N) > 0) {
+			N = glm::normalize(N);
+		}
+	}
+
+	// Corners that match a vertex at the same position share it.
+	vector<int> firstAt(positions.size(), -1);	// Most recent vertex made at each position.
+	vector<int> nextAt;							// Next older vertex at the same position.
+	vector<int> texCoordOf, normalOf;			// Attributes each vertex was made from.
+	mesh.vertices.reserve(positions.size());
+	mesh.indices.reserve(numCorners);
+	for (const ObjPiece& piece : pieces) {
+		for (const ObjCorner& corner : piece.corners) {
+			const int p = corner.index[0], t = corner.index[1], n = corner.index[2];
+			int v = firstAt[p];
+			while (v != -1 && (texCoordOf[v] != t || normalOf[v] != n)) {
+				v = nextAt[v];
+			}
+			if (v == -1) {
+				v = (int)mesh.vertices.size();
+				nextAt.push_back(firstAt[p]);
+				firstAt[p] = v;
+				texCoordOf.push_back(t);
+				normalOf.push_back(n);
+				mesh.vertices.push_back(VertexData(dvec4(positions[p], 1.0),
+					n != NO_INDEX ? normals[n] : dvec3(0, 0, 0), mat));
+				if (hasTexCoords) {
+					mesh.texCoords.push_back(t != NO_INDEX ? texCoords[t] : dvec2(0, 0));
+				}
+			}
+			mesh.indices.push_back((unsigned int)v);
+		}
+	}
+
+	// Vertices without a normal get the average of the faces around them.
+	vector<dvec3> normalSums;
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const unsigned int* tri = &mesh.indices[i];
+		if (normalOf[tri[0]] != NO_INDEX && normalOf[tri[1]] != NO_INDEX && normalOf[tri[2]] != NO_INDEX) {
+			continue;
+		}
+		if (normalSums.empty()) {
+			normalSums.assign(mesh.vertices.size(), dvec3(0, 0, 0));
+		}
+		// Not normalized, so larger faces count for more when averaging.
+		const dvec3 A = mesh.vertices[tri[0]].pos.xyz();
+		dvec3 faceNormal = glm::cross(mesh.vertices[tri[1]].pos.xyz() - A,
+			mesh.vertices[tri[2]].pos.xyz() - A);
+		for (int j = 0; j < 3; j++) {
+			normalSums[tri[j]] += faceNormal;
+		}
+	}
+	for (size_t i = 0; i < normalSums.size(); i++) {
+		if (normalOf[i] == NO_INDEX) {
+			mesh.vertices[i].normal = glm::length(normalSums[i]) > 0 ?
+				glm::normalize(normalSums[i]) : dvec3(0, 0, 1);
+		}
+	}
+	return true;
+}
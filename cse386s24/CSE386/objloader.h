@@ -0,0 +1,29 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <string>
+#include "eshape.h"
+
+const size_t MIN_OBJ_BYTES_PER_THREAD = 1 << 20;	//!< Smaller pieces of a file are not worth a thread.
+
+/**
+ * @struct	ObjLoader
+ * @brief	Reads Wavefront OBJ files into indexed meshes. The file is memory mapped and
+ * 			split at line boundaries into one piece per thread; the pieces are parsed
+ * 			in parallel and then stitched together. Positions (v), texture coordinates
+ * 			(vt), normals (vn) and faces (f) are read, including negative (relative)
+ * 			indices; faces with more than three corners are split into a fan of
+ * 			triangles. Other statements (o, g, s, usemtl, mtllib, ...) are skipped.
+ */
+
+struct ObjLoader {
+	static bool load(const std::string& filename, const Material& mat, IndexedEShapeData& mesh);
+};
@@ -645,6 +645,23 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	double yMin = glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y));
 	double yMax = glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y));
 
+	// Triangles are only clipped to the guard band, so stay inside the window.
+	xMin = std::max(xMin, 0.0);
+	yMin = std::max(yMin, 0.0);
+	xMax = std::min(xMax, frameBuffer.getWindowWidth() - 1.0);
+	yMax = std::min(yMax, frameBuffer.getWindowHeight() - 1.0);
+
+	// Skip triangles entirely behind what is already in the depth buffer.
+	if (FragmentOps::performDepthTest &&
+		min(v0.pos.z, v1.pos.z, v2.pos.z) >= frameBuffer.getMaxDepth((int)xMin, (int)yMin,
+																	(int)xMax, (int)yMax)) {
+		return;
+	}
+
+	// Most triangles have one material; copying it avoids interpolation and keeps
+	// it identical to the vertex material (which deferred shading relies upon).
+	const bool oneMaterial = v0.material == v1.material && v1.material == v2.material;
+
 	double fAlpha = f12(v0, v1, v2, v0.pos.x, v0.pos.y);
 	double fBeta = f20(v0, v1, v2, v1.pos.x, v1.pos.y);
 	double fGamma = f01(v0, v1, v2, v2.pos.x, v2.pos.y);
@@ -665,8 +682,9 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 					Fragment fragment;
 
 					// Interpolate vertex attributes using alpha, beta, and gamma weights
-					fragment.material = barycentricWeighting(alpha, beta, gamma,
-						v0.material, v1.material, v2.material);
+					fragment.material = oneMaterial ? v0.material :
+						barycentricWeighting(alpha, beta, gamma,
+							v0.material, v1.material, v2.material);
 					fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
 						v0.normal, v1.normal, v2.normal);
 					fragment.worldPos = barycentricWeighting(alpha, beta, gamma,
@@ -682,19 +700,23 @@ void drawFilledTriangle(FrameBuffer& frameBuffer, const dvec3& eyePos,
 }
 
 /**
- * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const vector<VertexData> &vertices, const dmat4 &viewingMatrix)
+ * @fn	void drawManyFilledTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, const vector<LightSourcePtr> &lights, const vector<VertexData> &vertices, const Frame &eyeFrame, const CancelToken *cancelToken)
  * @brief	Draw many filled triangles,
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
  * @param 		  	vertices	 	The vector of vertice-triplets.
  * @param 		  	eyeFrame    	The camera's frame.
+ * @param 		  	cancelToken 	If not nullptr, checked every CANCEL_CHECK_INTERVAL triangles.
  */
 
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
-	const Frame& eyeFrame) {
+	const Frame& eyeFrame, const CancelToken* cancelToken) {
 	for (int i = 0; i < (int)vertices.size() - 2; i += 3) {
+		if (i % (3 * CANCEL_CHECK_INTERVAL) == 0 && isCancelled(cancelToken)) {
+			return;
+		}
 		const VertexData& Vi = vertices[i];
 		const VertexData& Vi1 = vertices[i + 1];
 		const VertexData& Vi2 = vertices[i + 2];
@@ -12,6 +12,7 @@
 #include "defs.h"
 #include "fragmentops.h"
 #include "vertexdata.h"
+#include "canceltoken.h"
 
 void drawAxisOnWindow(FrameBuffer& frameBuffer);
 void drawWirePolygon(FrameBuffer& frameBuffer, const vector<dvec3>& pts, const color& rgb);
@@ -38,6 +39,6 @@ void drawManyWireFrameTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const Frame& eyeFrame);
 void drawManyFilledTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
 	const vector<LightSourcePtr>& lights, const vector<VertexData>& vertices,
-	const Frame& eyeFrame);
+	const Frame& eyeFrame, const CancelToken* cancelToken = nullptr);
 void drawArc(FrameBuffer& fb, const dvec2& center, double R,
 	double startRads, double lengthInRads, const color& rgb);
\ No newline at end of file
@@ -6,6 +6,8 @@
  * of this material is prohibited unless prior written
  * permission is granted.
  ****************************************************/
+#include <atomic>
+#include <thread>
 #include "raytracer.h"
 #include "ishape.h"
 #include "io.h"
@@ -17,27 +19,118 @@
   */
 
 RayTracer::RayTracer(const color& defa)
-	: defaultColor(defa) {
+	: defaultColor(defa), exposure(1.0), toneMap(ToneMap::NONE), gamma(1.0) {
 }
 
 /**
- * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene) const
- * @brief	Raytrace scene
+ * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene,
+ *										const int &N, const CancelToken *cancelToken) const
+ * @brief	Raytrace scene and show the result.
  * @param [in,out]	frameBuffer	Framebuffer.
  * @param 		  	depth	   	The current depth of recursion.
  * @param 		  	theScene   	The scene.
+ * @param 		  	N		   	Rays per pixel along each axis.
+ * @param 		  	cancelToken	If not nullptr, checked before each tile.
  */
 
 void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
-	const IScene& theScene, const int& N) const {
+	const IScene& theScene, const int& N, const CancelToken* cancelToken) const {
+	raytraceImage(frameBuffer, depth, theScene, N, cancelToken);
+	frameBuffer.showColorBuffer();
+}
+
+/**
+ * @fn	bool RayTracer::raytraceImage(FrameBuffer &frameBuffer, int depth, const IScene &theScene,
+ *										const int &N, const CancelToken *cancelToken,
+ *										const TileFunction &tileDone) const
+ * @brief	Raytrace scene into the framebuffer's color buffer. Does not call OpenGL, so
+ * 			it may run on any thread. The window is divided into RAYTRACE_TILE_SIZE
+ * 			square tiles, which threads take one at a time. A tile is owned by the
+ * 			thread that takes it, so writes to the framebuffer need no synchronization.
+ * 			Samples are summed in the framebuffer's accumulation buffer, which is
+ * 			attached or cleared here, and each tile is resolved into the color buffer
+ * 			with the exposure, tone map and gamma as soon as it is traced.
+ * 			Each thread checks the cancel token before starting a tile, so a cancelled
+ * 			frame stops within one tile.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	depth	   	The current depth of recursion.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	N		   	Rays per pixel along each axis.
+ * @param 		  	cancelToken	If not nullptr, checked before each tile.
+ * @param 		  	tileDone   	If set, called with the bounds of each tile once it is traced,
+ * 								on the thread that traced it.
+ * @return	True if every tile was traced, even if the frame was cancelled afterwards.
+ */
+
+bool RayTracer::raytraceImage(FrameBuffer& frameBuffer, int depth,
+	const IScene& theScene, const int& N, const CancelToken* cancelToken,
+	const TileFunction& tileDone) const {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const int tilesX = (W + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+	const int tilesY = (H + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+	const int numTiles = tilesX * tilesY;
+	std::atomic<int> nextTile(0);
+	std::atomic<int> tilesDone(0);
+	if (frameBuffer.isAccumulating()) {
+		frameBuffer.clearAccumulation();
+	} else {
+		frameBuffer.setAccumulation(true);
+	}
+
+	auto worker = [&]() {
+		for (int tile = nextTile++; tile < numTiles; tile = nextTile++) {
+			if (isCancelled(cancelToken)) {
+				return;
+			}
+			int left = (tile % tilesX) * RAYTRACE_TILE_SIZE;
+			int bottom = (tile / tilesX) * RAYTRACE_TILE_SIZE;
+			int right = std::min(left + RAYTRACE_TILE_SIZE, W);
+			int top = std::min(bottom + RAYTRACE_TILE_SIZE, H);
+			raytraceTile(frameBuffer, theScene, N, left, bottom, right, top);
+			tilesDone++;
+			if (tileDone) {
+				tileDone(left, bottom, right, top);
+			}
+		}
+	};
+	int numThreads = std::min((int)std::max(1u, std::thread::hardware_concurrency()), numTiles);
+	vector<std::thread> workers;
+	for (int t = 1; t < numThreads; t++) {
+		workers.push_back(std::thread(worker));
+	}
+	worker();
+	for (std::thread& thread : workers) {
+		thread.join();
+	}
+	return tilesDone == numTiles;
+}
+
+/**
+ * @fn	void RayTracer::raytraceTile(FrameBuffer &frameBuffer, const IScene &theScene,
+ *									const int &N, int left, int bottom, int right, int top) const
+ * @brief	Raytraces the pixels in [left, right) x [bottom, top), one row at a time,
+ * 			adding every sample to the accumulation buffer, then resolves the tile.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	N		   	Rays per pixel along each axis.
+ * @param 		  	left	   	First column.
+ * @param 		  	bottom	   	First row.
+ * @param 		  	right	   	One past the last column.
+ * @param 		  	top		   	One past the last row.
+ */
+
+void RayTracer::raytraceTile(FrameBuffer& frameBuffer, const IScene& theScene, const int& N,
+	int left, int bottom, int right, int top) const {
 	const RaytracingCamera& camera = *theScene.camera;
 	const vector<VisibleIShapePtr>& opaqueObjs = theScene.opaqueObjs;
 	const vector<TransparentIShapePtr>& transObjs = theScene.transparentObjs;
 	const vector<LightSourcePtr>& lights = theScene.lights;
-	color defaultColor = frameBuffer.getClearColor();
+	vector<Ray> axisRays;
+	axisRays.reserve((right - left) * (top - bottom));
 
-	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
-		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
 			DEBUG_PIXEL = (x == xDebug && y == yDebug);
 			if (DEBUG_PIXEL) {
 				cout << "";
@@ -45,7 +138,6 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 			/* CSE 386 - todo  */
 			vector<Ray> rays = camera.getRay(x, y, N);
 
-			color sum = black;
 			for (unsigned int i = 0; i < rays.size(); i++) {
 				Ray ray = rays[i];
 				// Transparency
@@ -70,7 +162,7 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 
 					// Texture
 					if (hit.texture != nullptr) {
-						color texel = hit.texture->getPixelUV(hit.u, hit.v);
+						color texel = hit.texture->getPixelUV(hit.u, hit.v, hit.dUV1, hit.dUV2);
 						finalColor = 0.5 * finalColor + 0.5 * texel;
 					}
 
@@ -79,7 +171,7 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 						finalColor = (1 - transHit.alpha) * finalColor + transHit.alpha * source;
 					}
 
-					sum += finalColor;
+					frameBuffer.accumulate(x, y, finalColor);
 				}
 				else {
 					color background = paleGreen;
@@ -88,15 +180,18 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 						background = (1 - transHit.alpha) * background + transHit.alpha * source;
 					}
 
-					sum += background;
+					frameBuffer.accumulate(x, y, background);
 				}
 			}
-			frameBuffer.setColor(x, y, sum / glm::pow(N, 2));
-			frameBuffer.showAxes(x, y, rays[0], 0.25);			// Displays R/x, G/y, B/z axes
+			axisRays.push_back(rays[0]);
+		}
+	}
+	frameBuffer.resolveAccumulation(left, bottom, right, top, exposure, toneMap, gamma);
+	for (int y = bottom; y < top; ++y) {
+		for (int x = left; x < right; ++x) {
+			frameBuffer.showAxes(x, y, axisRays[(y - bottom) * (right - left) + x - left], 0.25);	// Displays R/x, G/y, B/z axes
 		}
 	}
-
-	frameBuffer.showColorBuffer();
 }
 
 /**
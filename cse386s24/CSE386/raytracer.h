@@ -9,10 +9,14 @@
 
 #pragma once
 
+#include <functional>
 #include "utilities.h"
 #include "framebuffer.h"
 #include "camera.h"
 #include "iscene.h"
+#include "canceltoken.h"
+
+const int RAYTRACE_TILE_SIZE = 4 * DEPTH_TILE_SIZE;	//!< Raytraced tiles are this many pixels square.
 
  /**
   * @struct	RayTracer
@@ -20,10 +24,21 @@
   */
 
 struct RayTracer {
+	typedef std::function<void(int left, int bottom, int right, int top)> TileFunction;
 	color defaultColor;			//!< the color to use if no intersection is present.
+	double exposure;			//!< Scale applied to each pixel's average sample before tone mapping.
+	ToneMap toneMap;			//!< Maps the exposed colors into [0, 1].
+	double gamma;				//!< Display gamma; 1 leaves colors linear.
 	RayTracer(const color& defaultColor);
 	void raytraceScene(FrameBuffer& frameBuffer, int depth,
-		const IScene& theScene, const int& N) const;
+		const IScene& theScene, const int& N,
+		const CancelToken* cancelToken = nullptr) const;
+	bool raytraceImage(FrameBuffer& frameBuffer, int depth,
+		const IScene& theScene, const int& N,
+		const CancelToken* cancelToken = nullptr,
+		const TileFunction& tileDone = TileFunction()) const;
 protected:
+	void raytraceTile(FrameBuffer& frameBuffer, const IScene& theScene, const int& N,
+		int left, int bottom, int right, int top) const;
 	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const;
 };
\ No newline at end of file
@@ -0,0 +1,252 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "renderthread.h"
+
+/**
+ * @fn	RenderThread::RenderThread(int width, int height, const color &clearColor)
+ * @brief	Constructs a render thread with two cleared framebuffers. The thread itself
+ * 			is not started until start is called.
+ * @param	width	  	The width of the framebuffers.
+ * @param	height	  	The height of the framebuffers.
+ * @param	clearColor	The clear color of the framebuffers.
+ */
+
+RenderThread::RenderThread(int width, int height, const color& clearColor)
+	: firstBuffer(width, height), secondBuffer(width, height), preview(width, height),
+	front(&firstBuffer), back(&secondBuffer), frontVersion(0), frontIsCurrent(false),
+	width(width), height(height), frameRequested(false), rendering(false), newFrame(false), quit(false) {
+	firstBuffer.setClearColor(clearColor);
+	firstBuffer.clearColorAndDepthBuffers();
+	secondBuffer.setClearColor(clearColor);
+	secondBuffer.clearColorAndDepthBuffers();
+	preview.setClearColor(clearColor);
+	preview.clearColorBuffer();
+}
+
+/**
+ * @fn	RenderThread::~RenderThread()
+ * @brief	Destructor. Cancels the frame in progress, if any, and waits for it to stop.
+ */
+
+RenderThread::~RenderThread() {
+	stop();
+}
+
+/**
+ * @fn	void RenderThread::start(const RenderFunction &renderFunction)
+ * @brief	Starts the render thread and requests the first frame.
+ * @param	renderFunction	Draws one frame into the framebuffer it is given, returning
+ * 							early if the cancel token it is given is set.
+ */
+
+void RenderThread::start(const RenderFunction& renderFunction) {
+	if (thread.joinable()) {
+		return;
+	}
+	this->renderFunction = renderFunction;
+	quit = false;
+	frameRequested = true;
+	thread = std::thread(&RenderThread::run, this);
+}
+
+/**
+ * @fn	void RenderThread::setVersionFunction(const VersionFunction &versionFunction)
+ * @brief	Sets the function used to decide whether a requested frame would differ from
+ * 			the one being shown. It is called on the render thread, after the queued
+ * 			updates are applied. Set it before calling start.
+ * @param	versionFunction	Returns a number that changes whenever the scene does.
+ */
+
+void RenderThread::setVersionFunction(const VersionFunction& versionFunction) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->versionFunction = versionFunction;
+	frontIsCurrent = false;
+}
+
+/**
+ * @fn	void RenderThread::stop()
+ * @brief	Stops the render thread, cancelling the frame in progress, if any.
+ */
+
+void RenderThread::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+		cancelToken.cancel();
+	}
+	wakeUp.notify_one();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+/**
+ * @fn	void RenderThread::requestFrame()
+ * @brief	Asks for another frame. Requests made while a frame is being rendered are
+ * 			combined into a single frame that starts when the current one finishes.
+ */
+
+void RenderThread::requestFrame() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		frameRequested = true;
+	}
+	wakeUp.notify_one();
+}
+
+/**
+ * @fn	void RenderThread::post(const Update &update, bool preempt)
+ * @brief	Queues a change to the scene and requests a frame. The render thread applies
+ * 			queued updates, in order, just before it starts the next frame, so they
+ * 			never run while the render function is reading the scene.
+ * @param	update 	The change.
+ * @param	preempt	If true, the frame in progress is cancelled, so the change is seen
+ * 					as soon as the render function notices. Use it for interactive
+ * 					changes; frequent preempting updates, such as animation steps,
+ * 					would keep any frame from finishing.
+ */
+
+void RenderThread::post(const Update& update, bool preempt) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		updates.push_back(update);
+		frameRequested = true;
+		if (preempt && rendering) {
+			cancelToken.cancel();
+		}
+	}
+	wakeUp.notify_one();
+}
+
+/**
+ * @fn	void RenderThread::resize(int width, int height)
+ * @brief	Changes the size of the frames rendered from now on, and requests a frame.
+ * @param	width 	The width.
+ * @param	height	The height.
+ */
+
+void RenderThread::resize(int width, int height) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->width = width;
+		this->height = height;
+		frameRequested = true;
+	}
+	wakeUp.notify_one();
+}
+
+/**
+ * @fn	bool RenderThread::hasNewFrame() const
+ * @brief	Determines whether a frame has finished since the last call to show.
+ * @return	True if there is a new frame to show.
+ */
+
+bool RenderThread::hasNewFrame() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return newFrame;
+}
+
+/**
+ * @fn	bool RenderThread::isRendering() const
+ * @brief	Determines whether a frame is being rendered.
+ * @return	True if the render thread is busy.
+ */
+
+bool RenderThread::isRendering() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return rendering;
+}
+
+/**
+ * @fn	void RenderThread::show(bool showPartialFrame)
+ * @brief	Shows the last completed frame. Must be called on the GLUT thread.
+ * @param	showPartialFrame	If true and a frame is in progress, shows the regions of it
+ * 								published so far, over the last completed frame.
+ */
+
+void RenderThread::show(bool showPartialFrame) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (showPartialFrame && rendering) {
+		std::lock_guard<std::mutex> previewLock(previewMutex);
+		preview.showColorBuffer();
+	} else {
+		front->showColorBuffer();
+		newFrame = false;
+	}
+}
+
+/**
+ * @fn	void RenderThread::publishRegion(int left, int bottom, int right, int top)
+ * @brief	Makes a finished region of the frame in progress visible to show(true). Call it
+ * 			from the render function, on any of its threads, once the region's pixels
+ * 			will no longer change.
+ * @param	left  	First column.
+ * @param	bottom	First row.
+ * @param	right 	One past the last column.
+ * @param	top   	One past the last row.
+ */
+
+void RenderThread::publishRegion(int left, int bottom, int right, int top) {
+	std::lock_guard<std::mutex> previewLock(previewMutex);
+	preview.copyColors(*back, left, bottom, right, top);
+}
+
+/**
+ * @fn	void RenderThread::run()
+ * @brief	Body of the render thread. Waits for a frame to be requested, applies the
+ * 			queued updates, renders into the back framebuffer and, unless the frame was
+ * 			cancelled, swaps. Frames that would match the one being shown are skipped.
+ */
+
+void RenderThread::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wakeUp.wait(lock, [this]() { return quit || frameRequested; });
+		if (quit) {
+			break;
+		}
+		frameRequested = false;
+		for (const Update& update : updates) {
+			update();
+		}
+		updates.clear();
+		bool sameSize = front->getWindowWidth() == width && front->getWindowHeight() == height;
+		if (versionFunction && frontIsCurrent && sameSize && versionFunction() == frontVersion) {
+			continue;
+		}
+		if (back->getWindowWidth() != width || back->getWindowHeight() != height) {
+			back->setFrameBufferSize(width, height);
+		}
+		{
+			std::lock_guard<std::mutex> previewLock(previewMutex);
+			if (preview.getWindowWidth() != width || preview.getWindowHeight() != height) {
+				preview.setFrameBufferSize(width, height);
+				preview.clearColorBuffer();
+			}
+			preview.copyColors(*front, 0, 0, width, height);
+		}
+		cancelToken.reset();
+		rendering = true;
+		lock.unlock();
+
+		renderFunction(*back, cancelToken);
+
+		lock.lock();
+		rendering = false;
+		if (!cancelToken.isCancelled()) {
+			std::swap(front, back);
+			newFrame = true;
+			if (versionFunction) {
+				frontVersion = versionFunction();
+				frontIsCurrent = true;
+			}
+		}
+	}
+}
@@ -0,0 +1,82 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "defs.h"
+#include "framebuffer.h"
+#include "canceltoken.h"
+
+/**
+ * @class	RenderThread
+ * @brief	Renders frames on a background thread so the GLUT thread stays responsive.
+ * 			Frames are drawn into a back framebuffer; when one is finished, the back
+ * 			and front framebuffers are swapped and the GLUT thread shows the front one.
+ * 			To preview a frame in progress, the render function publishes the regions
+ * 			it has finished; they are copied over the last frame into a third
+ * 			framebuffer, which the GLUT thread can show without reading pixels that
+ * 			are still being written.
+ *
+ * 			The render function runs on the render thread and must not call OpenGL.
+ * 			Anything the render function reads should only be changed by updates
+ * 			passed to post, which the render thread applies between frames. An update
+ * 			can preempt the frame in progress: the frame's cancel token is set, the
+ * 			render function is expected to return soon after, and the unfinished
+ * 			frame is discarded rather than shown.
+ *
+ * 			If a version function is set, a requested frame is skipped when the
+ * 			version it returns and the window size are the same as for the frame
+ * 			being shown, so an idle scene costs nothing to redisplay.
+ */
+
+class RenderThread {
+public:
+	typedef std::function<void(FrameBuffer&, const CancelToken&)> RenderFunction;
+	typedef std::function<void()> Update;
+	typedef std::function<unsigned long()> VersionFunction;
+	RenderThread(int width, int height, const color& clearColor);
+	~RenderThread();
+	void start(const RenderFunction& renderFunction);
+	void setVersionFunction(const VersionFunction& versionFunction);
+	void stop();
+	void requestFrame();
+	void post(const Update& update, bool preempt = false);
+	void resize(int width, int height);
+	bool hasNewFrame() const;
+	bool isRendering() const;
+	void show(bool showPartialFrame = false);
+	void publishRegion(int left, int bottom, int right, int top);
+protected:
+	void run();
+	FrameBuffer firstBuffer;		//!< One of the two framebuffers.
+	FrameBuffer secondBuffer;		//!< The other framebuffer.
+	FrameBuffer preview;			//!< The last frame overlaid with the published parts of back.
+	FrameBuffer* front;				//!< Last completed frame. Only changed while holding mutex.
+	FrameBuffer* back;				//!< Frame being rendered.
+	RenderFunction renderFunction;	//!< Draws one frame.
+	VersionFunction versionFunction;	//!< Identifies the state of the scene, or empty.
+	unsigned long frontVersion;		//!< Scene version the front frame was rendered from.
+	bool frontIsCurrent;			//!< True once a frame has been rendered with a version function.
+	vector<Update> updates;			//!< Changes to apply before the next frame.
+	int width;						//!< Requested framebuffer width.
+	int height;						//!< Requested framebuffer height.
+	bool frameRequested;			//!< True if another frame should be rendered.
+	bool rendering;					//!< True while a frame is being rendered.
+	bool newFrame;					//!< True if front has not been shown since it was swapped in.
+	bool quit;						//!< True when the thread should exit.
+	mutable std::mutex mutex;		//!< Guards everything above except the contents of back and preview.
+	std::mutex previewMutex;		//!< Guards the contents of preview. Taken after mutex, if both are.
+	std::condition_variable wakeUp;	//!< Signaled when there is work or it is time to quit.
+	CancelToken cancelToken;		//!< Set to abandon the frame in progress.
+	std::thread thread;				//!< The render thread.
+};
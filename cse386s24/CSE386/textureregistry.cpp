@@ -0,0 +1,139 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "textureregistry.h"
+
+/**
+ * @struct	TextureAsset
+ * @brief	A texture in the registry. The image is created exactly once, by whichever
+ * 			comes first: the background loader or a thread that needs it.
+ */
+
+struct TextureAsset {
+	std::string path;				//!< File the texture is read from.
+	ImageFormat format;				//!< How the texels are stored.
+	std::once_flag loadOnce;		//!< Guards the creation of image.
+	std::unique_ptr<Image> image;	//!< The texture, once loaded.
+	std::atomic<bool> loaded;		//!< True once image has been created.
+	std::thread loader;				//!< Background loader, if one was started.
+	TextureAsset(const std::string& path, ImageFormat format)
+		: path(path), format(format), loaded(false) {
+	}
+	~TextureAsset() {
+		if (loader.joinable()) {
+			loader.join();
+		}
+	}
+	void load() {
+		std::call_once(loadOnce, [this]() {
+			image.reset(new Image(path, format));
+			loaded.store(true, std::memory_order_release);
+		});
+	}
+};
+
+typedef std::map<std::pair<std::string, ImageFormat>, std::unique_ptr<TextureAsset>> TextureMap;
+
+/**
+ * @fn	static TextureMap &getAssets(std::mutex *&mutex)
+ * @brief	Gets the registry's textures, and the mutex guarding them. They are created on
+ * 			first use so that textures can be requested while globals are constructed.
+ */
+
+static TextureMap& getAssets(std::mutex*& mutex) {
+	static std::mutex assetsMutex;
+	static TextureMap assets;
+	mutex = &assetsMutex;
+	return assets;
+}
+
+/**
+ * @fn	bool TextureHandle::isReady() const
+ * @brief	Determines whether get would return without waiting for the file to be read.
+ * @return	True if the texture is in memory, or failed to load.
+ */
+
+bool TextureHandle::isReady() const {
+	return asset == nullptr || asset->loaded.load(std::memory_order_acquire);
+}
+
+/**
+ * @fn	Image* TextureHandle::load(TextureAsset &asset)
+ * @brief	Gets a registry texture, reading the file first if no one has yet. Threads
+ * 			that ask while the file is being read wait for it.
+ * @param	asset	The texture.
+ * @return	The image, or nullptr if the file could not be read.
+ */
+
+Image* TextureHandle::load(TextureAsset& asset) {
+	if (!asset.loaded.load(std::memory_order_acquire)) {
+		asset.load();
+	}
+	return asset.image->isLoaded() ? asset.image.get() : nullptr;
+}
+
+/**
+ * @fn	TextureHandle TextureRegistry::get(const std::string &path, ImageFormat format, TextureLoading loading)
+ * @brief	Gets a handle to the texture in a file. The file is only read once, however
+ * 			many times it is asked for.
+ * @param	path   	The PPM file.
+ * @param	format 	How to store the texels.
+ * @param	loading	When to read the file. Asking for ASYNC starts the background loader
+ * 					even if the texture was first asked for as LAZY.
+ * @return	The handle.
+ */
+
+TextureHandle TextureRegistry::get(const std::string& path, ImageFormat format,
+	TextureLoading loading) {
+	std::mutex* mutex;
+	TextureMap& assets = getAssets(mutex);
+	std::lock_guard<std::mutex> lock(*mutex);
+	std::unique_ptr<TextureAsset>& asset = assets[std::make_pair(path, format)];
+	if (asset == nullptr) {
+		asset.reset(new TextureAsset(path, format));
+	}
+	if (loading == TextureLoading::ASYNC && !asset->loader.joinable() && !asset->loaded) {
+		asset->loader = std::thread(&TextureAsset::load, asset.get());
+	}
+	return TextureHandle(*asset);
+}
+
+/**
+ * @fn	void TextureRegistry::waitForAll()
+ * @brief	Waits for every background loader to finish.
+ */
+
+void TextureRegistry::waitForAll() {
+	std::mutex* mutex;
+	TextureMap& assets = getAssets(mutex);
+	std::lock_guard<std::mutex> lock(*mutex);
+	for (auto& entry : assets) {
+		if (entry.second->loader.joinable()) {
+			entry.second->loader.join();
+		}
+	}
+}
+
+/**
+ * @fn	size_t TextureRegistry::size()
+ * @brief	Gets the number of textures in the registry.
+ * @return	The number of distinct (path, format) pairs asked for.
+ */
+
+size_t TextureRegistry::size() {
+	std::mutex* mutex;
+	TextureMap& assets = getAssets(mutex);
+	std::lock_guard<std::mutex> lock(*mutex);
+	return assets.size();
+}
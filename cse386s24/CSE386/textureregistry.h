@@ -0,0 +1,60 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+
+#include <string>
+#include "image.h"
+
+/**
+ * @enum	TextureLoading
+ * @brief	When a texture is read from its file. LAZY waits until the texture is
+ * 			first used; ASYNC starts reading it right away on a background thread.
+ */
+
+enum class TextureLoading { LAZY, ASYNC };
+
+struct TextureAsset;
+
+/**
+ * @class	TextureHandle
+ * @brief	Refers to a texture. Handles are cheap to copy, and all handles to the same
+ * 			file and format share one image. A handle can also wrap an image the caller
+ * 			owns, which is how a plain Image* converts to a handle.
+ */
+
+class TextureHandle {
+public:
+	TextureHandle() : asset(nullptr), image(nullptr) {}
+	TextureHandle(Image* image) : asset(nullptr), image(image) {}
+	bool isNull() const { return asset == nullptr && image == nullptr; }
+	bool isReady() const;
+	Image* get() const { return asset != nullptr ? load(*asset) : image; }
+protected:
+	friend class TextureRegistry;
+	explicit TextureHandle(TextureAsset& asset) : asset(&asset), image(nullptr) {}
+	static Image* load(TextureAsset& asset);
+	TextureAsset* asset;	//!< The registry's entry, or nullptr.
+	Image* image;			//!< The caller's image, when asset is nullptr.
+};
+
+/**
+ * @class	TextureRegistry
+ * @brief	Owns every texture loaded from a file, keyed by path and format, so that a
+ * 			file named by several shapes or scenes is read and stored once. Textures
+ * 			are kept until the program exits.
+ */
+
+class TextureRegistry {
+public:
+	static TextureHandle get(const std::string& path, ImageFormat format = ImageFormat::COLOR,
+		TextureLoading loading = TextureLoading::LAZY);
+	static void waitForAll();
+	static size_t size();
+};
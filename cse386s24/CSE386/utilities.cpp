@@ -11,6 +11,7 @@
 #include <istream>
 #include <iomanip>
 #include <cstdlib>
+#include <cstring>
 
 #include "defs.h"
 #include "framebuffer.h"
@@ -989,7 +990,62 @@ string extractBaseFilename(const string& str) {
 	return str.substr(pos + 1);
 }
 
-bool DEBUG_PIXEL = false;
+/**
+* @fn	static std::uint64_t rotateLeft(std::uint64_t x, int r)
+* @brief	Rotates a 64 bit word left by r bits, 0 < r < 64.
+*/
+
+static inline std::uint64_t rotateLeft(std::uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+* @fn	static std::uint64_t mixWord(std::uint64_t k)
+* @brief	Scrambles an 8 byte word, so that every input bit affects many bits, before it
+* 			is combined into the hash.
+*/
+
+static inline std::uint64_t mixWord(std::uint64_t k) {
+	k *= 0x87c37b91114253d5ULL;
+	k = rotateLeft(k, 31);
+	return k * 0x4cf5ad432745937fULL;
+}
+
+/**
+* @fn	std::uint64_t hashBytes(const void *data, size_t size)
+* @brief	Computes a 64 bit hash of a block of memory, in the style of MurmurHash3: 8
+* 			bytes at a time, each word mixed before it is combined, so that hashing a
+* 			large file costs about as much as reading it. Used to tell whether a cached
+* 			file was made from the file it claims to be. Not cryptographic.
+* @param	data	The bytes.
+* @param	size	The number of bytes.
+* @return	The hash.
+*/
+
+std::uint64_t hashBytes(const void* data, size_t size) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	std::uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		std::uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		hash ^= mixWord(word);
+		hash = rotateLeft(hash, 27) * 5 + 0x52dce729;
+	}
+	if (i < size) {
+		std::uint64_t word = 0;
+		std::memcpy(&word, bytes + i, size - i);
+		hash ^= mixWord(word);
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+thread_local bool DEBUG_PIXEL = false;
 int xDebug = -1, yDebug = -1;
 
 void mouseUtility(int b, int s, int x, int y) {
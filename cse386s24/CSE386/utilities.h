@@ -12,10 +12,11 @@
 #include <istream>
 #include <vector>
 #include <cmath>
+#include <cstdint>
 #include <string>
 #include "defs.h"
 
-extern bool DEBUG_PIXEL;
+extern thread_local bool DEBUG_PIXEL;
 extern int xDebug, yDebug;
 void mouseUtility(int, int, int, int);
 void keyboardUtility(unsigned char key, int x, int y);
@@ -77,6 +78,7 @@ void computeAzimuthAndElevationFromXYZ(const dvec3& pt,
 	double& R, double& az, double& el);
 
 string extractBaseFilename(const string& str);
+std::uint64_t hashBytes(const void* data, size_t size);
 
 // 2D versions
 dmat3 T(double dx, double dy);
@@ -37,3 +37,20 @@ struct VertexData {
 };
 
 VertexData operator * (double w, const VertexData& V1);
+
+/**
+ * @struct	CompactVertex
+ * @brief	Compact vertex layout for meshes that do not need double precision. The
+ * 			position and normal are floats and the material is a 16-bit index into a
+ * 			MaterialTable, so a vertex takes 28 bytes instead of the 160 of a VertexData.
+ * 			Positions are assumed to be points (w = 1).
+ */
+
+struct CompactVertex {
+	glm::vec3 pos;					//!< Position, in object coordinates.
+	glm::vec3 normal;				//!< Normal vector, in object coordinates.
+	unsigned short materialIndex;	//!< Index into the mesh's MaterialTable.
+
+	CompactVertex(const VertexData& vd, MaterialTable& materials);
+	VertexData toVertexData(const MaterialTable& materials) const;
+};
@@ -20,6 +20,66 @@ vector<IPlane> VertexOps::allButNearNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1,
 	//												IPlane(dvec3(0, 0, -1), dvec3(0, 0, 1))
 };
 
+// Triangles are only clipped against x and y once they leave a band this many times
+// wider than the view volume. Everything inside it is left to the rasterizer.
+
+double VertexOps::guardBandScale = 4.0;
+
+thread_local VertexArena VertexOps::arena;
+
+// Outcode bits. The first six are the clip space planes triangles are actually clipped
+// against: near, far and the four sides of the guard band. The last four are the sides
+// of the view volume, which are only used to reject triangles that are entirely outside.
+
+const int NUM_CLIP_PLANES = 6;
+const unsigned int CLIP_PLANE_BITS = (1 << NUM_CLIP_PLANES) - 1;
+const unsigned int OUT_LEFT = 1 << 6;
+const unsigned int OUT_RIGHT = 1 << 7;
+const unsigned int OUT_BOTTOM = 1 << 8;
+const unsigned int OUT_TOP = 1 << 9;
+
+/**
+ * @fn	static dvec4 clipPlane(int i, double G)
+ * @brief	Returns the coefficients of one of the clip space planes. A point P is on the
+ * 			inside of the plane when dot(plane, P) >= 0.
+ * @param	i	Index of the plane, 0 through NUM_CLIP_PLANES - 1.
+ * @param	G	Guard band scale.
+ * @return	The plane coefficients.
+ */
+
+static dvec4 clipPlane(int i, double G) {
+	switch (i) {
+	case 0:		return dvec4(0, 0, 1, 1);		// near:	z >= -w
+	case 1:		return dvec4(0, 0, -1, 1);		// far:		z <= w
+	case 2:		return dvec4(1, 0, 0, G);		// left:	x >= -Gw
+	case 3:		return dvec4(-1, 0, 0, G);		// right:	x <= Gw
+	case 4:		return dvec4(0, 1, 0, G);		// bottom:	y >= -Gw
+	default:	return dvec4(0, -1, 0, G);		// top:		y <= Gw
+	}
+}
+
+/**
+ * @fn	static unsigned int computeOutcode(const dvec4 &P, double G)
+ * @brief	Computes the outcode of a clip space position.
+ * @param	P	Position in clip space (before the perspective division).
+ * @param	G	Guard band scale.
+ * @return	The outcode. Zero means the point is inside the guard band and between near and far.
+ */
+
+static unsigned int computeOutcode(const dvec4& P, double G) {
+	unsigned int code = 0;
+	for (int i = 0; i < NUM_CLIP_PLANES; i++) {
+		if (glm::dot(clipPlane(i, G), P) < 0) {
+			code |= 1 << i;
+		}
+	}
+	if (P.x < -P.w) code |= OUT_LEFT;
+	if (P.x > P.w) code |= OUT_RIGHT;
+	if (P.y < -P.w) code |= OUT_BOTTOM;
+	if (P.y > P.w) code |= OUT_TOP;
+	return code;
+}
+
 /**
  * @fn	vector<VertexData> triangulate(const vector<VertexData> &poly)
  * @brief	Triangulates the given polygon
@@ -236,21 +296,224 @@ vector<VertexData> VertexOps::transformVertices(const dmat4& TM, const vector<Ve
 	return transformedVertices;
 }
 
-double computeNearPlane(const dmat4& PM) {
-	double alpha = PM[2][2];
-	double beta = PM[3][2];
-	double gamma = PM[2][3];
-	double omega = PM[3][3];
-	double nearf = -(omega + beta) / (alpha + gamma);
-	return nearf;
+/**
+ * @fn	void VertexOps::clipTriangleInClipSpace(const VertexData &v0, const VertexData &v1,
+ *												const VertexData &v2, unsigned int planeMask,
+ *												vector<VertexData> &polygon,
+ *												vector<VertexData> &scratch)
+ * @brief	Clips a triangle against the clip space planes selected by planeMask. Clipping
+ * 			is done before the perspective division, so no special cases are needed for
+ * 			vertices behind the eye.
+ * @param 		  	v0		 	First vertex, in clip space.
+ * @param 		  	v1		 	Second vertex, in clip space.
+ * @param 		  	v2		 	Third vertex, in clip space.
+ * @param 		  	planeMask	Outcode bits of the planes to clip against.
+ * @param [out]   	polygon  	The clipped polygon (empty if nothing is left).
+ * @param [in,out]	scratch  	Working storage. Reused between calls to avoid allocations.
+ */
+
+void VertexOps::clipTriangleInClipSpace(const VertexData& v0, const VertexData& v1,
+	const VertexData& v2, unsigned int planeMask,
+	vector<VertexData>& polygon, vector<VertexData>& scratch) {
+	const double G = guardBandScale;
+
+	polygon.clear();
+	polygon.push_back(v0);
+	polygon.push_back(v1);
+	polygon.push_back(v2);
+
+	for (int p = 0; p < NUM_CLIP_PLANES && polygon.size() > 2; p++) {
+		if ((planeMask & (1 << p)) == 0) {
+			continue;
+		}
+		const dvec4 plane = clipPlane(p, G);
+
+		scratch.clear();
+		for (unsigned int i = 0; i < polygon.size(); i++) {
+			const VertexData& a = polygon[i];
+			const VertexData& b = polygon[(i + 1) % polygon.size()];
+			double da = glm::dot(plane, a.pos);
+			double db = glm::dot(plane, b.pos);
+
+			if (da >= 0) {
+				scratch.push_back(a);
+			}
+			if ((da >= 0) != (db >= 0)) {
+				double t = da / (da - db);
+				scratch.push_back(VertexData(1.0 - t, a, t, b));
+			}
+		}
+		polygon.swap(scratch);
+	}
+	if (polygon.size() < 3) {
+		polygon.clear();
+	}
+}
+
+/**
+ * @fn	void VertexOps::emitTriangle(const VertexData &v0, const VertexData &v1,
+ *									const VertexData &v2, const dmat4 &viewportMatrix,
+ *									bool renderBackfaces, vector<VertexData> &windowCoords)
+ * @brief	Finishes a clipped triangle: perspective division, backface removal and the
+ * 			viewport transformation. The result is appended to windowCoords.
+ * @param 		  	v0				First vertex, in clip space.
+ * @param 		  	v1				Second vertex, in clip space.
+ * @param 		  	v2				Third vertex, in clip space.
+ * @param 		  	viewportMatrix	The viewport transformation.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	windowCoords	Vertices in window coordinates.
+ */
+
+void VertexOps::emitTriangle(const VertexData& v0, const VertexData& v1,
+	const VertexData& v2, const dmat4& viewportMatrix, bool renderBackfaces,
+	vector<VertexData>& windowCoords) {
+	// Clipping against near and far guarantees w > 0.
+	dvec3 p0 = v0.pos.xyz() / v0.pos.w;
+	dvec3 p1 = v1.pos.xyz() / v1.pos.w;
+	dvec3 p2 = v2.pos.xyz() / v2.pos.w;
+
+	// z component of the triangle's normal. Counterclockwise triangles face the viewer;
+	// triangles with no area, or a NaN one, face neither way and are dropped.
+	double nz = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+	if (!(nz > 0.0 || nz < 0.0)) {
+		return;
+	}
+	bool backFacing = nz < 0.0;
+	if (backFacing && !renderBackfaces) {
+		return;
+	}
+
+	const VertexData* verts[3] = { &v0, &v1, &v2 };
+	const dvec3* ndc[3] = { &p0, &p1, &p2 };
+	for (int i = 0; i < 3; i++) {
+		windowCoords.push_back(*verts[i]);
+		VertexData& v = windowCoords.back();
+		v.pos = viewportMatrix * dvec4(*ndc[i], 1.0);
+		if (backFacing) {
+			v.normal *= -1;
+		}
+	}
+}
+
+/**
+ * @fn	VertexData VertexOps::transformVertex(const VertexData &v, const dmat4 &modelingMatrix,
+ *												const dmat3 &normalMatrix,
+ *												const dmat4 &viewProjectionMatrix,
+ *												const Material *material)
+ * @brief	Takes a single vertex from object coordinates to clip coordinates, saving its
+ * 			world position and unit world normal for lighting.
+ * @param	v						The vertex, in object coordinates.
+ * @param	modelingMatrix			The modeling matrix.
+ * @param	normalMatrix			Inverse transpose of the upper 3x3 of the modeling matrix.
+ * @param	viewProjectionMatrix	Projection matrix times viewing matrix.
+ * @param	material				Material replacing the vertex's own, or nullptr.
+ * @return	The vertex in clip coordinates.
+ */
+
+VertexData VertexOps::transformVertex(const VertexData& v, const dmat4& modelingMatrix,
+	const dmat3& normalMatrix, const dmat4& viewProjectionMatrix,
+	const Material* material) {
+	dvec4 worldPos = modelingMatrix * v.pos;
+	return VertexData(viewProjectionMatrix * worldPos, glm::normalize(normalMatrix * v.normal),
+		material != nullptr ? *material : v.material, worldPos.xyz());
+}
+
+/**
+ * @fn	void VertexOps::processClipSpaceTriangle(const VertexData &v0, const VertexData &v1,
+ *												const VertexData &v2, const dmat4 &viewportMatrix,
+ *												bool renderBackfaces, VertexArena &arena)
+ * @brief	Clips, culls and viewport transforms a single triangle, appending whatever is
+ * 			left of it to arena.windowCoords.
+ * 			Triangles entirely outside the view volume are rejected and those inside the
+ * 			guard band are passed straight through; only the remaining few are clipped.
+ * @param 		  	v0				First vertex, in clip space.
+ * @param 		  	v1				Second vertex, in clip space.
+ * @param 		  	v2				Third vertex, in clip space.
+ * @param 		  	viewportMatrix	The viewport transformation.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	arena			Scratch storage and output.
+ */
+
+void VertexOps::processClipSpaceTriangle(const VertexData& v0, const VertexData& v1,
+	const VertexData& v2, const dmat4& viewportMatrix, bool renderBackfaces,
+	VertexArena& arena) {
+	const double G = guardBandScale;
+	unsigned int c0 = computeOutcode(v0.pos, G);
+	unsigned int c1 = computeOutcode(v1.pos, G);
+	unsigned int c2 = computeOutcode(v2.pos, G);
+
+	if ((c0 & c1 & c2) != 0) {				// Trivial reject: all outside one plane
+		return;
+	}
+	unsigned int crossed = (c0 | c1 | c2) & CLIP_PLANE_BITS;
+	if (crossed == 0) {						// Trivial accept: rasterizer handles the rest
+		emitTriangle(v0, v1, v2, viewportMatrix, renderBackfaces, arena.windowCoords);
+		return;
+	}
+	vector<VertexData>& polygon = arena.polygon;
+	clipTriangleInClipSpace(v0, v1, v2, crossed, polygon, arena.scratch);
+	for (unsigned int j = 1; j + 1 < polygon.size(); j++) {
+		emitTriangle(polygon[0], polygon[j], polygon[j + 1],
+			viewportMatrix, renderBackfaces, arena.windowCoords);
+	}
+}
+
+/**
+ * @fn	FrameConstants::FrameConstants(const PipelineMatrices &pipeMats)
+ * @brief	Computes the per frame values from the pipeline matrices.
+ * @param	pipeMats	The pipeline matrices.
+ */
+
+FrameConstants::FrameConstants(const PipelineMatrices& pipeMats)
+	: viewProjectionMatrix(pipeMats.projectionMatrix * pipeMats.viewingMatrix),
+	viewportMatrix(pipeMats.viewportMatrix),
+	eyePos(glm::inverse(pipeMats.viewingMatrix)[3].xyz()),
+	eyeFrame(Frame::createOrthoNormalBasis(pipeMats.viewingMatrix)),
+	perspective(pipeMats.projectionMatrix[3][3] == 0.0) {
+}
+
+/**
+ * @fn	void VertexOps::transformTriangles(const vector<VertexData> &objectCoords,
+ *											const dmat4 &modelingMatrix,
+ *											const FrameConstants &constants,
+ *											bool renderBackfaces, VertexArena &arena,
+ *											const Material *material)
+ * @brief	Transforms the triangle vertices through pipeline:
+ *					object -> world -> clip -> ndc -> window.
+ * 			Each triangle goes through every stage before the next one is started, and
+ * 			the finished triangles are appended to arena.windowCoords, so no intermediate
+ * 			copies of the mesh are made.
+ * @param 		  	objectCoords  	The object coordinates.
+ * @param 		  	modelingMatrix	The modeling matrix.
+ * @param 		  	constants	  	Per frame values.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	arena		  	Scratch storage and output.
+ * @param 		  	material	  	Material used for every vertex, or nullptr to use the mesh's.
+ */
+
+void VertexOps::transformTriangles(const vector<VertexData>& objectCoords,
+	const dmat4& modelingMatrix,
+	const FrameConstants& constants,
+	bool renderBackfaces,
+	VertexArena& arena,
+	const Material* material) {
+	const dmat4& VP = constants.viewProjectionMatrix;
+	const dmat3 normalMatrix = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+
+	for (int i = 0; i < (int)objectCoords.size() - 2; i += 3) {
+		VertexData v0 = transformVertex(objectCoords[i], modelingMatrix, normalMatrix, VP, material);
+		VertexData v1 = transformVertex(objectCoords[i + 1], modelingMatrix, normalMatrix, VP, material);
+		VertexData v2 = transformVertex(objectCoords[i + 2], modelingMatrix, normalMatrix, VP, material);
+		processClipSpaceTriangle(v0, v1, v2, constants.viewportMatrix, renderBackfaces, arena);
+	}
 }
 
 /**
  * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *												const vector<LightSourcePtr> &lights,
  *												const vector<VertexData> &objectCoords)
- * @brief	Transforms the triangle vertices through pipeline:
- *					object -> world -> eye -> clip/ndc -> window.
+ * @brief	Transforms the triangle vertices through the pipeline (see transformTriangles),
+ * 			using this thread's VertexOps::arena, and rasterizes them.
  * @param [in,out]	frameBuffer 	Buffer for frame data.
  * @param 		  	eyePos			The eye position.
  * @param 		  	lights			The lights.
@@ -263,39 +526,262 @@ void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& e
 	const dmat4& modelingMatrix,
 	const PipelineMatrices& pipeMats,
 	bool renderBackfaces) {
-	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
-	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
-	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
+	FrameConstants constants(pipeMats);
+	arena.windowCoords.clear();
+	transformTriangles(objectCoords, modelingMatrix, constants, renderBackfaces, arena);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, arena.windowCoords, constants.eyeFrame);
+}
 
-	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
-	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
+const unsigned int NOT_TRANSFORMED = 0xFFFFFFFF;
 
-	double nearZ = computeNearPlane(projectionMatrix);
-	vector <IPlane> nearPlane = { IPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS) };
-	vector<VertexData> eyeCoordsClippedOnNearPlane = clipPolygon(eyeCoords, nearPlane);
+/**
+ * @fn	void VertexOps::computeFrustumPlanes(const dmat4 &clipMatrix, dvec4 planes[6])
+ * @brief	Extracts the six planes of the view volume from a matrix that maps to clip
+ * 			coordinates. The planes are in the coordinate system the matrix maps from,
+ * 			so with projection * viewing * modeling, they are in object coordinates.
+ * 			A point P is inside plane i when dot(planes[i], P) >= 0.
+ * @param 		  	clipMatrix	Matrix mapping to clip coordinates.
+ * @param [out]   	planes	  	The six planes.
+ */
 
-	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoordsClippedOnNearPlane);
-	vector<VertexData> clipCoords;
+void VertexOps::computeFrustumPlanes(const dmat4& clipMatrix, dvec4 planes[6]) {
+	dvec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = dvec4(clipMatrix[0][i], clipMatrix[1][i], clipMatrix[2][i], clipMatrix[3][i]);
+	}
+	planes[0] = rows[3] + rows[0];		// left
+	planes[1] = rows[3] - rows[0];		// right
+	planes[2] = rows[3] + rows[1];		// bottom
+	planes[3] = rows[3] - rows[1];		// top
+	planes[4] = rows[3] + rows[2];		// near
+	planes[5] = rows[3] - rows[2];		// far
+}
 
-	for (VertexData v : projCoords) {		// Perspective division
-		if (v.pos.w >= 0) {
-			v.pos /= v.pos.w;
-		} else {							// should not happen
-			v.pos.x /= -v.pos.w;
-			v.pos.y /= -v.pos.w;
-			v.pos.z = -std::abs(v.pos.z / -v.pos.w);
-			v.pos.w = 1.0;
+/**
+ * @fn	bool VertexOps::isOutsideFrustum(const dvec4 planes[6], const MeshBounds &bounds)
+ * @brief	Determines if a bounding box is entirely outside the view volume. The test is
+ * 			conservative: it may keep a box that is not visible, but never rejects one
+ * 			that is.
+ * @param	planes	The planes of the view volume (see computeFrustumPlanes).
+ * @param	bounds	The bounds to test.
+ * @return	True if the box is entirely outside one of the planes.
+ */
+
+bool VertexOps::isOutsideFrustum(const dvec4 planes[6], const MeshBounds& bounds) {
+	if (!bounds.isKnown()) {
+		return false;
+	}
+	for (int i = 0; i < 6; i++) {
+		const dvec4& plane = planes[i];
+		// Corner of the box farthest along the plane's normal
+		dvec4 P(plane.x >= 0 ? bounds.maxCorner.x : bounds.minCorner.x,
+				plane.y >= 0 ? bounds.maxCorner.y : bounds.minCorner.y,
+				plane.z >= 0 ? bounds.maxCorner.z : bounds.minCorner.z, 1.0);
+		if (glm::dot(plane, P) < 0) {
+			return true;
 		}
-		clipCoords.push_back(v);
 	}
+	return false;
+}
 
-	clipCoords = processBackwardFacingTriangles(clipCoords, renderBackfaces);
+/**
+ * @fn	bool VertexOps::isBackFacing(const Meshlet &meshlet, const dvec3 &eyePosInObjectCoords)
+ * @brief	Determines if every triangle of a meshlet faces away from the eye, using its
+ * 			bounding sphere and normal cone. Let d be the vector from the eye to the
+ * 			sphere's center, beta the angle between d and the cone's axis, and alpha the
+ * 			cone's half angle. No face normal is within beta + alpha of d, so every point
+ * 			of every face is behind the eye if |d| cos(beta + alpha) >= radius.
+ * @param	meshlet					The meshlet.
+ * @param	eyePosInObjectCoords	The eye position, in object coordinates.
+ * @return	True if the whole meshlet is back facing.
+ */
 
-	vector<VertexData> ndcCoords = clipPolygon(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+bool VertexOps::isBackFacing(const Meshlet& meshlet, const dvec3& eyePosInObjectCoords) {
+	if (meshlet.coneCosAngle <= 0.0 || !meshlet.bounds.isKnown()) {
+		return false;
+	}
+	dvec3 d = meshlet.bounds.center - eyePosInObjectCoords;
+	double dist = glm::length(d);
+	if (dist <= meshlet.bounds.radius) {
+		return false;
+	}
+	double cosBeta = glm::dot(d, meshlet.coneAxis) / dist;
+	double sinBeta = std::sqrt(std::max(0.0, 1.0 - cosBeta * cosBeta));
+	double cosSum = cosBeta * meshlet.coneCosAngle - sinBeta * meshlet.coneSinAngle;
+	return dist * cosSum >= meshlet.bounds.radius;
+}
 
-	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
-	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
+/**
+ * @fn	template <class Mesh> void VertexOps::transformMeshTriangles(const Mesh &mesh,
+ *												const dmat4 &modelingMatrix,
+ *												const FrameConstants &constants,
+ *												bool renderBackfaces, VertexArena &arena,
+ *												const Material *material)
+ * @brief	Vertex stage for indexed meshes (IndexedEShapeData or CompactEShapeData).
+ * 			The whole mesh is first tested against the view volume. Then each meshlet is
+ * 			tested against the view volume and, unless backfaces are rendered, against
+ * 			its normal cone. Only vertices used by the remaining meshlets are transformed,
+ * 			each exactly once. Finished triangles are appended to arena.windowCoords.
+ * @param 		  	mesh		  	The mesh, in object coordinates.
+ * @param 		  	modelingMatrix	The modeling matrix.
+ * @param 		  	constants	  	Per frame values.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	arena		  	Scratch storage and output.
+ * @param 		  	material	  	Material used for every vertex, or nullptr to use the mesh's.
+ */
+
+template <class Mesh>
+void VertexOps::transformMeshTriangles(const Mesh& mesh,
+	const dmat4& modelingMatrix,
+	const FrameConstants& constants,
+	bool renderBackfaces,
+	VertexArena& arena,
+	const Material* material) {
+	const dmat4& VP = constants.viewProjectionMatrix;
+	dvec4 frustum[6];
+	computeFrustumPlanes(VP * modelingMatrix, frustum);
+	if (isOutsideFrustum(frustum, mesh.bounds)) {
+		return;
+	}
+
+	// The cone test needs a perspective projection and a modeling matrix that does
+	// not mirror the object, which would swap front and back faces.
+	const dmat3 M3x3(modelingMatrix);
+	const bool cullBackFaces = !renderBackfaces && constants.perspective &&
+		glm::determinant(M3x3) > 0;
+	const dvec3 eyeInObject = (glm::inverse(modelingMatrix) * dvec4(constants.eyePos, 1.0)).xyz();
+	const dmat3 normalMatrix = glm::transpose(glm::inverse(M3x3));
+
+	vector<VertexData>& clipCoords = arena.clipCoords;
+	vector<unsigned int>& clipIndex = arena.clipIndex;
+	clipCoords.clear();
+	clipIndex.assign(mesh.vertices.size(), NOT_TRANSFORMED);
+
+	const vector<unsigned int>& indices = mesh.indices;
+	const unsigned int numMeshlets = std::max(1u, (unsigned int)mesh.meshlets.size());
+	for (unsigned int m = 0; m < numMeshlets; m++) {
+		unsigned int first = 0;
+		unsigned int count = (unsigned int)indices.size() / 3 * 3;
+		if (!mesh.meshlets.empty()) {
+			const Meshlet& meshlet = mesh.meshlets[m];
+			if (isOutsideFrustum(frustum, meshlet.bounds) ||
+				(cullBackFaces && isBackFacing(meshlet, eyeInObject))) {
+				continue;
+			}
+			first = meshlet.firstIndex;
+			count = meshlet.indexCount;
+		}
+		for (unsigned int i = first; i < first + count; i += 3) {
+			for (unsigned int j = i; j < i + 3; j++) {
+				unsigned int v = indices[j];
+				if (clipIndex[v] == NOT_TRANSFORMED) {
+					clipIndex[v] = (unsigned int)clipCoords.size();
+					clipCoords.push_back(transformVertex(mesh.vertexAt(v),
+						modelingMatrix, normalMatrix, VP, material));
+				}
+			}
+			processClipSpaceTriangle(clipCoords[clipIndex[indices[i]]],
+				clipCoords[clipIndex[indices[i + 1]]],
+				clipCoords[clipIndex[indices[i + 2]]],
+				constants.viewportMatrix, renderBackfaces, arena);
+		}
+	}
+}
+
+/**
+ * @fn	void VertexOps::transformTriangles(const IndexedEShapeData &mesh,
+ *											const dmat4 &modelingMatrix,
+ *											const FrameConstants &constants,
+ *											bool renderBackfaces, VertexArena &arena,
+ *											const Material *material)
+ * @brief	Vertex stage for an indexed mesh. See transformMeshTriangles.
+ * @param 		  	mesh		  	The mesh, in object coordinates.
+ * @param 		  	modelingMatrix	The modeling matrix.
+ * @param 		  	constants	  	Per frame values.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	arena		  	Scratch storage and output.
+ * @param 		  	material	  	Material used for every vertex, or nullptr to use the mesh's.
+ */
+
+void VertexOps::transformTriangles(const IndexedEShapeData& mesh,
+	const dmat4& modelingMatrix,
+	const FrameConstants& constants,
+	bool renderBackfaces,
+	VertexArena& arena,
+	const Material* material) {
+	transformMeshTriangles(mesh, modelingMatrix, constants, renderBackfaces, arena, material);
+}
+
+/**
+ * @fn	void VertexOps::transformTriangles(const CompactEShapeData &mesh,
+ *											const dmat4 &modelingMatrix,
+ *											const FrameConstants &constants,
+ *											bool renderBackfaces, VertexArena &arena,
+ *											const Material *material)
+ * @brief	Vertex stage for a mesh in the compact vertex format. Vertices are expanded
+ * 			to double precision as they are transformed. See transformMeshTriangles.
+ * @param 		  	mesh		  	The mesh, in object coordinates.
+ * @param 		  	modelingMatrix	The modeling matrix.
+ * @param 		  	constants	  	Per frame values.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	arena		  	Scratch storage and output.
+ * @param 		  	material	  	Material used for every vertex, or nullptr to use the mesh's.
+ */
+
+void VertexOps::transformTriangles(const CompactEShapeData& mesh,
+	const dmat4& modelingMatrix,
+	const FrameConstants& constants,
+	bool renderBackfaces,
+	VertexArena& arena,
+	const Material* material) {
+	transformMeshTriangles(mesh, modelingMatrix, constants, renderBackfaces, arena, material);
+}
+
+/**
+ * @fn	void VertexOps::processIndexedTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *												const vector<LightSourcePtr> &lights,
+ *												const IndexedEShapeData &mesh)
+ * @brief	Same as processTriangleVertices, but for indexed meshes. See
+ * 			transformMeshTriangles.
+ * @param [in,out]	frameBuffer 	Buffer for frame data.
+ * @param 		  	eyePos			The eye position.
+ * @param 		  	lights			The lights.
+ * @param 		  	mesh			The mesh, in object coordinates.
+ */
+
+void VertexOps::processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const IndexedEShapeData& mesh,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	FrameConstants constants(pipeMats);
+	arena.windowCoords.clear();
+	transformTriangles(mesh, modelingMatrix, constants, renderBackfaces, arena);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, arena.windowCoords, constants.eyeFrame);
+}
+
+/**
+ * @fn	void VertexOps::processCompactTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *												const vector<LightSourcePtr> &lights,
+ *												const CompactEShapeData &mesh)
+ * @brief	Same as processIndexedTriangles, but for meshes in the compact vertex format.
+ * @param [in,out]	frameBuffer 	Buffer for frame data.
+ * @param 		  	eyePos			The eye position.
+ * @param 		  	lights			The lights.
+ * @param 		  	mesh			The mesh, in object coordinates.
+ */
+
+void VertexOps::processCompactTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const CompactEShapeData& mesh,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	FrameConstants constants(pipeMats);
+	arena.windowCoords.clear();
+	transformTriangles(mesh, modelingMatrix, constants, renderBackfaces, arena);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, arena.windowCoords, constants.eyeFrame);
 }
 
 /**
@@ -364,6 +850,195 @@ void VertexOps::render(FrameBuffer& frameBuffer, const vector<VertexData>& verts
 		modelingMatrix, pipeMats, renderBackfaces);
 }
 
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const IndexedEShapeData &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
+ * @brief	Renders an indexed mesh
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ */
+
+void VertexOps::render(FrameBuffer& frameBuffer, const IndexedEShapeData& mesh,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+
+	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
+	VertexOps::processIndexedTriangles(frameBuffer, eyePos, lights, mesh,
+		modelingMatrix, pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const CompactEShapeData &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
+ * @brief	Renders a mesh stored in the compact vertex format
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ */
+
+void VertexOps::render(FrameBuffer& frameBuffer, const CompactEShapeData& mesh,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+
+	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
+	VertexOps::processCompactTriangles(frameBuffer, eyePos, lights, mesh,
+		modelingMatrix, pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	template <class Mesh> void VertexOps::renderInstancedMesh(FrameBuffer &frameBuffer,
+ *												const Mesh &mesh,
+ *												const vector<dmat4> &modelingMatrices,
+ *												const vector<Material> &materials,
+ *												const vector<LightSourcePtr> &lights,
+ *												const PipelineMatrices &pipeMats,
+ *												bool renderBackfaces)
+ * @brief	Renders one copy of a mesh per modeling matrix. The per frame values are
+ * 			computed once for all the copies, and the normal matrix once per copy.
+ * @param [in,out]	frameBuffer			Buffer for frame data.
+ * @param 		  	mesh				The mesh shared by all the copies.
+ * @param 		  	modelingMatrices	One modeling matrix per copy.
+ * @param 		  	materials			One material per copy, or empty to use the mesh's materials.
+ * 										Nothing is drawn if it is neither.
+ * @param 		  	lights				The lights.
+ * @param 		  	pipeMats			The pipeline matrices.
+ * @param           renderBackfaces		True if backfaces are to be rendered.
+ */
+
+template <class Mesh>
+void VertexOps::renderInstancedMesh(FrameBuffer& frameBuffer, const Mesh& mesh,
+	const vector<dmat4>& modelingMatrices,
+	const vector<Material>& materials,
+	const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	if (!materials.empty() && materials.size() != modelingMatrices.size()) {
+		return;
+	}
+	FrameConstants constants(pipeMats);
+	arena.windowCoords.clear();
+	for (unsigned int i = 0; i < modelingMatrices.size(); i++) {
+		const Material* material = materials.empty() ? nullptr : &materials[i];
+		transformTriangles(mesh, modelingMatrices[i], constants, renderBackfaces,
+			arena, material);
+	}
+	drawManyFilledTriangles(frameBuffer, constants.eyePos, lights, arena.windowCoords,
+		constants.eyeFrame);
+}
+
+/**
+ * @fn	void VertexOps::renderInstanced(FrameBuffer &frameBuffer, const EShapeData &mesh,
+ *										const vector<dmat4> &modelingMatrices,
+ *										const vector<Material> &materials,
+ *										const vector<LightSourcePtr> &lights,
+ *										const PipelineMatrices &pipeMats,
+ *										bool renderBackfaces)
+ * @brief	Renders several copies of the same triangles. See renderInstancedMesh.
+ * @param [in,out]	frameBuffer			Buffer for frame data.
+ * @param 		  	mesh				The triangles shared by all the copies.
+ * @param 		  	modelingMatrices	One modeling matrix per copy.
+ * @param 		  	materials			One material per copy, or empty to use the mesh's materials.
+ * @param 		  	lights				The lights.
+ * @param 		  	pipeMats			The pipeline matrices.
+ * @param           renderBackfaces		True if backfaces are to be rendered.
+ */
+
+void VertexOps::renderInstanced(FrameBuffer& frameBuffer, const EShapeData& mesh,
+	const vector<dmat4>& modelingMatrices,
+	const vector<Material>& materials,
+	const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	renderInstancedMesh(frameBuffer, mesh, modelingMatrices, materials, lights,
+		pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	void VertexOps::renderInstanced(FrameBuffer &frameBuffer, const IndexedEShapeData &mesh,
+ *										const vector<dmat4> &modelingMatrices,
+ *										const vector<Material> &materials,
+ *										const vector<LightSourcePtr> &lights,
+ *										const PipelineMatrices &pipeMats,
+ *										bool renderBackfaces)
+ * @brief	Renders several copies of the same indexed mesh. See renderInstancedMesh.
+ * @param [in,out]	frameBuffer			Buffer for frame data.
+ * @param 		  	mesh				The mesh shared by all the copies.
+ * @param 		  	modelingMatrices	One modeling matrix per copy.
+ * @param 		  	materials			One material per copy, or empty to use the mesh's materials.
+ * @param 		  	lights				The lights.
+ * @param 		  	pipeMats			The pipeline matrices.
+ * @param           renderBackfaces		True if backfaces are to be rendered.
+ */
+
+void VertexOps::renderInstanced(FrameBuffer& frameBuffer, const IndexedEShapeData& mesh,
+	const vector<dmat4>& modelingMatrices,
+	const vector<Material>& materials,
+	const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	renderInstancedMesh(frameBuffer, mesh, modelingMatrices, materials, lights,
+		pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	void VertexOps::renderInstanced(FrameBuffer &frameBuffer, const CompactEShapeData &mesh,
+ *										const vector<dmat4> &modelingMatrices,
+ *										const vector<Material> &materials,
+ *										const vector<LightSourcePtr> &lights,
+ *										const PipelineMatrices &pipeMats,
+ *										bool renderBackfaces)
+ * @brief	Renders several copies of the same compact mesh. See renderInstancedMesh.
+ * @param [in,out]	frameBuffer			Buffer for frame data.
+ * @param 		  	mesh				The mesh shared by all the copies.
+ * @param 		  	modelingMatrices	One modeling matrix per copy.
+ * @param 		  	materials			One material per copy, or empty to use the mesh's materials.
+ * @param 		  	lights				The lights.
+ * @param 		  	pipeMats			The pipeline matrices.
+ * @param           renderBackfaces		True if backfaces are to be rendered.
+ */
+
+void VertexOps::renderInstanced(FrameBuffer& frameBuffer, const CompactEShapeData& mesh,
+	const vector<dmat4>& modelingMatrices,
+	const vector<Material>& materials,
+	const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	renderInstancedMesh(frameBuffer, mesh, modelingMatrices, materials, lights,
+		pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	void VertexOps::renderDeferredLighting(FrameBuffer &frameBuffer,
+ *												const vector<LightSourcePtr> &lights,
+ *												const PipelineMatrices &pipeMats)
+ * @brief	Runs the lighting pass of deferred shading. Call this once per frame, after
+ * 			all objects have been rendered into a framebuffer that has deferred shading
+ * 			turned on.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	pipeMats    The pipeline matrices
+ */
+
+void VertexOps::renderDeferredLighting(FrameBuffer& frameBuffer,
+	const vector<LightSourcePtr>& lights,
+	const PipelineMatrices& pipeMats) {
+	Frame eyeFrame = Frame::createOrthoNormalBasis(pipeMats.viewingMatrix);
+	FragmentOps::processDeferredLighting(frameBuffer, lights, eyeFrame);
+}
+
 /**
  * @fn	void VertexOps::getViewportTransformation()
  * @brief	Sets viewport transformation based on the current viewport settings.
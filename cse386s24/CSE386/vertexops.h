@@ -13,6 +13,7 @@
 #include "framebuffer.h"
 #include "light.h"
 #include "vertexdata.h"
+#include "eshape.h"
 #include "iscene.h"
 #include "rasterization.h"
 
@@ -27,6 +28,36 @@ struct PipelineMatrices {
 	dmat4 viewportMatrix;
 };
 
+/**
+ * @struct	FrameConstants
+ * @brief	Values derived from the pipeline matrices that are the same for every object
+ * 			drawn in a frame, so they can be computed once per frame.
+ */
+
+struct FrameConstants {
+	dmat4 viewProjectionMatrix;		//!< Projection matrix times viewing matrix.
+	dmat4 viewportMatrix;			//!< The viewport transformation.
+	dvec3 eyePos;					//!< Eye position, in world coordinates.
+	Frame eyeFrame;					//!< The camera's frame.
+	bool perspective;				//!< True if the projection is a perspective projection.
+	FrameConstants(const PipelineMatrices& pipeMats);
+};
+
+/**
+ * @struct	VertexArena
+ * @brief	Scratch storage for the vertex stage. The vectors are cleared but never
+ * 			shrunk, so once they have grown to fit the largest object, pushing a mesh
+ * 			through the pipeline does not allocate.
+ */
+
+struct VertexArena {
+	vector<VertexData> clipCoords;		//!< Transformed vertices of an indexed mesh.
+	vector<unsigned int> clipIndex;		//!< Where each mesh vertex is in clipCoords, or NOT_TRANSFORMED.
+	vector<VertexData> windowCoords;	//!< Finished triangles, ready for the rasterizer.
+	vector<VertexData> polygon;			//!< Polygon being clipped.
+	vector<VertexData> scratch;			//!< Working storage for the clipper.
+};
+
 /**
  * @class	VertexOps
  * @brief	Class to encapsulate the methods related to vertex processing for Pipeline graphics.
@@ -35,6 +66,8 @@ struct PipelineMatrices {
 class VertexOps {
 public:
 	static vector<IPlane> allButNearNDCPlanes;		//!< 5 of the 6 planes of the 2x2x2 cube.
+	static double guardBandScale;					//!< Size of the guard band, relative to the view volume.
+	static thread_local VertexArena arena;			//!< Scratch storage reused by the render calls on each thread.
 
 	static void processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
@@ -42,6 +75,18 @@ public:
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces);
+	static void processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+		const vector<LightSourcePtr>& lights,
+		const IndexedEShapeData& mesh,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	static void processCompactTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+		const vector<LightSourcePtr>& lights,
+		const CompactEShapeData& mesh,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 	static void processLineSegments(FrameBuffer& frameBuffer, const dvec3& eyePos,
 		const vector<LightSourcePtr>& lights,
 		const vector<VertexData>& objectCoords,
@@ -53,6 +98,57 @@ public:
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces
 	);
+	static void render(FrameBuffer& frameBuffer, const IndexedEShapeData& mesh,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces
+	);
+	static void render(FrameBuffer& frameBuffer, const CompactEShapeData& mesh,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces
+	);
+	static void transformTriangles(const vector<VertexData>& objectCoords,
+		const dmat4& modelingMatrix,
+		const FrameConstants& constants,
+		bool renderBackfaces,
+		VertexArena& arena,
+		const Material* material = nullptr);
+	static void transformTriangles(const IndexedEShapeData& mesh,
+		const dmat4& modelingMatrix,
+		const FrameConstants& constants,
+		bool renderBackfaces,
+		VertexArena& arena,
+		const Material* material = nullptr);
+	static void transformTriangles(const CompactEShapeData& mesh,
+		const dmat4& modelingMatrix,
+		const FrameConstants& constants,
+		bool renderBackfaces,
+		VertexArena& arena,
+		const Material* material = nullptr);
+	static void renderInstanced(FrameBuffer& frameBuffer, const EShapeData& mesh,
+		const vector<dmat4>& modelingMatrices,
+		const vector<Material>& materials,
+		const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	static void renderInstanced(FrameBuffer& frameBuffer, const IndexedEShapeData& mesh,
+		const vector<dmat4>& modelingMatrices,
+		const vector<Material>& materials,
+		const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	static void renderInstanced(FrameBuffer& frameBuffer, const CompactEShapeData& mesh,
+		const vector<dmat4>& modelingMatrices,
+		const vector<Material>& materials,
+		const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	static void renderDeferredLighting(FrameBuffer& frameBuffer,
+		const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats);
 	static dmat4 getViewportTransformation(int left, int width, int bottom, int height);
 protected:
 	static vector<VertexData> clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane);
@@ -65,4 +161,33 @@ protected:
 	static vector<VertexData> transformVerticesToWorldCoordinates(const dmat4& modelMatrix,
 		const vector<VertexData>& vertices);
 	static vector<VertexData> transformVertices(const dmat4& TM, const vector<VertexData>& vertices);
+	static VertexData transformVertex(const VertexData& v, const dmat4& modelingMatrix,
+		const dmat3& normalMatrix, const dmat4& viewProjectionMatrix,
+		const Material* material = nullptr);
+	static void processClipSpaceTriangle(const VertexData& v0, const VertexData& v1,
+		const VertexData& v2, const dmat4& viewportMatrix, bool renderBackfaces,
+		VertexArena& arena);
+	template <class Mesh>
+	static void renderInstancedMesh(FrameBuffer& frameBuffer, const Mesh& mesh,
+		const vector<dmat4>& modelingMatrices,
+		const vector<Material>& materials,
+		const vector<LightSourcePtr>& lights,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	template <class Mesh>
+	static void transformMeshTriangles(const Mesh& mesh,
+		const dmat4& modelingMatrix,
+		const FrameConstants& constants,
+		bool renderBackfaces,
+		VertexArena& arena,
+		const Material* material = nullptr);
+	static void computeFrustumPlanes(const dmat4& clipMatrix, dvec4 planes[6]);
+	static bool isOutsideFrustum(const dvec4 planes[6], const MeshBounds& bounds);
+	static bool isBackFacing(const Meshlet& meshlet, const dvec3& eyePosInObjectCoords);
+	static void clipTriangleInClipSpace(const VertexData& v0, const VertexData& v1,
+		const VertexData& v2, unsigned int planeMask,
+		vector<VertexData>& polygon, vector<VertexData>& scratch);
+	static void emitTriangle(const VertexData& v0, const VertexData& v1, const VertexData& v2,
+		const dmat4& viewportMatrix, bool renderBackfaces,
+		vector<VertexData>& windowCoords);
 };
@@ -41,7 +41,8 @@ VertexData::VertexData(double w1, const VertexData& vd1,
 	double w2, const VertexData& vd2)
 	: pos(weightedAverage(w1, vd1.pos, w2, vd2.pos)),
 	normal(weightedAverage(w1, vd1.normal, w2, vd2.normal)),
-	material(weightedAverage(w1, vd1.material, w2, vd2.material)),
+	material(vd1.material == vd2.material ? vd1.material :
+		weightedAverage(w1, vd1.material, w2, vd2.material)),
 	worldPos(weightedAverage(w1, vd1.worldPos, w2, vd2.worldPos)) {
 }
 
@@ -98,3 +99,33 @@ VertexData VertexData::operator + (const VertexData& other) const {
 	result.worldPos += other.worldPos;
 	return result;
 }
+
+/**
+ * @fn	CompactVertex::CompactVertex(const VertexData &vd, MaterialTable &materials)
+ * @brief	Constructs a compact copy of a VertexData, adding its material to the table.
+ * 			If the table is full, materialIndex is OVERFLOW_MATERIAL and the caller must
+ * 			keep the material itself, as CompactEShapeData does.
+ * @param 		  	vd		 	The vertex to copy.
+ * @param [in,out]	materials	The material table shared by the mesh.
+ */
+
+CompactVertex::CompactVertex(const VertexData& vd, MaterialTable& materials)
+	: pos(glm::vec3(vd.pos.xyz())),
+	normal(glm::vec3(vd.normal)),
+	materialIndex(materials.indexOf(vd.material)) {
+}
+
+/**
+ * @fn	VertexData CompactVertex::toVertexData(const MaterialTable &materials) const
+ * @brief	Expands this vertex back into a full VertexData.
+ * @param	materials	The material table shared by the mesh.
+ * @return	The equivalent VertexData. If materialIndex is not in the table, such as
+ * 			OVERFLOW_MATERIAL, the material is left at its default.
+ */
+
+VertexData CompactVertex::toVertexData(const MaterialTable& materials) const {
+	if (materialIndex >= materials.size()) {
+		return VertexData(dvec4(dvec3(pos), 1.0), dvec3(normal), Material());
+	}
+	return VertexData(dvec4(dvec3(pos), 1.0), dvec3(normal), materials[materialIndex]);
+}